@@ -1,6 +1,49 @@
 // SPDX-License-Identifier: MIT
 #include <stdint.h>
 
+#ifndef __H_BINI_INDEX__
+#define __H_BINI_INDEX__
+// Hashed index of all KEYs of an INI-file image, for lookups of APP and KEY
+// pairs without traversing the lists. Slots are provided by user.
+
+// slot of the index
+typedef struct bini_slot_s
+{
+    uint32_t    hash;            // hash of APP and KEY names
+    uint32_t    app_offset;      // offset of the APP structure
+    uint32_t    key_offset;      // offset of the KEY structure, zero in free slot
+} bini_slot_t;
+
+typedef struct bini_index_s
+{
+    const uint8_t  *image;       // INI-file the index refers to
+    bini_slot_t    *slot;
+    uint32_t        mask;        // number of slots - 1
+    uint32_t        keys;        // number of KEYs indexed
+} bini_index_t;
+#endif // __H_BINI_INDEX__
+
+#ifndef __H_BINI_WRITER__
+#define __H_BINI_WRITER__
+// In-memory model of INI-file for the writer
+
+// KEY and its value
+typedef struct bini_wkey_s
+{
+    const char     *name;
+    const uint8_t  *val;
+    uint16_t        val_length;
+} bini_wkey_t;
+
+// APP and its KEYs
+typedef struct bini_wapp_s
+{
+    const char         *name;
+    const bini_wkey_t  *keys;
+    uint32_t            key_count;
+} bini_wapp_t;
+#endif // __H_BINI_WRITER__
+
 #ifndef BINI_IMPLEMENT
 // Prototype for the single INI-read function
 // Parameters:
@@ -9,6 +52,55 @@
 //            length - length of buffer in bytes
 int read_bini(void* inst, uint8_t *buf, uint32_t length);
 
+// Prototype for reading INI-file from its image in memory, e.g. mapped file.
+// Names and values are passed to PROCESS_APP, PROCESS_KEY right from the image,
+// nothing is copied, callbacks must not write to them. READ_FILE_AT is not used.
+// Parameters:
+//            inst   - instance pointer
+//            image  - whole INI file
+//            size   - size of image in bytes
+int read_bini_mem(void* inst, const uint8_t *image, uint32_t size);
+
+// Prototype for the number of slots needed by the index of INI-file image,
+// returns 0 if image is incorrect
+uint32_t bini_index_slots(const uint8_t *image, uint32_t size);
+
+// Prototype for building the index of INI-file image in one pass over its lists.
+// Index refers to the image, it must stay while the index is used.
+// Parameters:
+//            idx    - index to build
+//            image  - whole INI file
+//            size   - size of image in bytes
+//            slots  - slots for the index
+//            count  - number of slots, from bini_index_slots
+// Returns BINI_SUCCESS, BINI_ERR_FILE or BINI_ERR_MEM if slots are not enough
+int bini_index_build(bini_index_t *idx, const uint8_t *image, uint32_t size, bini_slot_t *slots, uint32_t count);
+
+// Prototype for the lookup of KEY value of APP in the index.
+// Returns value right in the image and its length, NULL if there is no such KEY
+const uint8_t *bini_lookup(const bini_index_t *idx, const char *app, const char *key, uint16_t *val_length);
+
+// Prototype for the size of INI-file image of the model,
+// returns 0 if names are longer than 65534 or file is over 4 GB
+uint32_t bini_image_size(const bini_wapp_t *apps, uint32_t count);
+
+// Prototype for building INI-file image of the model. Each APP is placed right
+// before its name and its KEYs, each KEY right before its name and value, in the
+// order of the lists, so traversal by read_bini reads the file sequentially.
+// Parameters:
+//            apps   - APPs of the model
+//            count  - number of APPs
+//            buf    - buffer for the image
+//            length - length of buffer in bytes
+// Returns size of the image, 0 if it does not fit into buffer
+uint32_t bini_build_image(const bini_wapp_t *apps, uint32_t count, uint8_t *buf, uint32_t length);
+
+// Prototype for writing INI-file of the model, image is built in the work
+// buffer and written at once by BINI_WRITE_FILE
+// Returns BINI_SUCCESS, BINI_ERR_MEM if buffer is too small, BINI_ERR_FILE if
+// model does not fit into INI-file or BINI_ERR_IO
+int write_bini(void* inst, const bini_wapp_t *apps, uint32_t count, uint8_t *buf, uint32_t length);
+
 // definitions, to be provided by user
 
 // Instance pointer or something like. Not used internally, 
@@ -18,13 +110,18 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length);
 // Error codes, returned at INI processing
 // #define BINI_SUCCESS                        0
 // #define BINI_DO_KEYS                        1
+// #define BINI_SKIP_KEY                       2   (optional, 2 by default)
 // #define BINI_ERR_MEM                        3
 // #define BINI_ERR_FILE                       4
 // #define BINI_ERR_IO                         5
 
-// Macros to be called from read_bini
+// Macros to be called from read_bini, read_bini is not built without it
 // #define BINI_READ_FILE_AT(handle, position, buffer, length)
 
+// Macro to be called from write_bini, writes whole file,
+// write_bini is not built without it
+// #define BINI_WRITE_FILE(handle, buffer, length)
+
 // callback from parser, passes the handle and the string of APP found,
 // must return !0 - process KEYs of that APP, 0 - goto next APP
 // #define BINI_PROCESS_APP(handle, app_string)
@@ -33,9 +130,18 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length);
 // must return !0 - continue KEYs processing for that APP, 0 - goto next APP
 // #define BINI_PROCESS_KEY(handle, key_string, value_buf, value_length)
 
+// optional callback from parser into application, passes file handle and KEY name string
+// before the value is read, must return
+// BINI_DO_KEYS - read the value and pass KEY to PROCESS_KEY, BINI_SKIP_KEY - goto next KEY
+// without reading the value, other - goto next APP
+// #define BINI_PROCESS_KEY_NAME(handle, key_string)
+
 #else //BINI_IMPLEMENT
 
 #define BINI_SIGNATURE         0xFFFFFFFFUL
+#ifndef BINI_SKIP_KEY
+#define BINI_SKIP_KEY          2
+#endif
 // INI-file internal structures
 // All offsets are relative to the start of the file.
 // uint16_t-typed fields are duplicated, both copies contains equal values. 
@@ -77,6 +183,37 @@ typedef struct bini_key_s
 } bini_key_t;
 #pragma pack(pop)
 
+#include <string.h>
+
+// validate header fields
+static int bini_hdr_ok(const bini_hdr_t *hdr)
+{
+    return (hdr->signature == BINI_SIGNATURE) && 
+           (hdr->zero[0] == 0)                && 
+           (hdr->zero[1] == 0)                && 
+           (hdr->first_app < hdr->file_size);
+}
+
+// validate APP fields
+static int bini_app_ok(const bini_app_t *app, const bini_hdr_t *hdr)
+{
+    return (app->zero == 0)                             && 
+           (app->name_length[0] == app->name_length[1]) && 
+           (app->key_offset < hdr->file_size)           && 
+           (app->name_offset < hdr->file_size);
+}
+
+// validate KEY fields
+static int bini_key_ok(const bini_key_t *key, const bini_hdr_t *hdr)
+{
+    return (key->zero == 0)                             && 
+           (key->name_length[0] == key->name_length[1]) &&
+           (key->val_length[0] == key->val_length[1])   &&
+           (key->name_offset <= hdr->file_size)         &&
+           (key->val_offset  <= hdr->file_size);
+}
+
+#ifdef BINI_READ_FILE_AT
 int read_bini(void* inst, uint8_t *buf, uint32_t length)
 {
     FILE_HANDLE hf = (FILE_HANDLE)inst;
@@ -85,6 +222,7 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length)
     uint32_t    app_offset;
     bini_key_t  key;
     uint32_t    key_offset;
+    int         action = BINI_DO_KEYS;
 
     // read INI header
     if (BINI_SUCCESS != BINI_READ_FILE_AT(hf, 0, (void*)&hdr, sizeof(bini_hdr_t)))
@@ -92,11 +230,7 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length)
         return BINI_ERR_IO;
     }
 
-    if ( (hdr.signature != BINI_SIGNATURE) || 
-         (hdr.zero[0] != 0)            || 
-         (hdr.zero[1] != 0)            || 
-         (hdr.first_app >= hdr.file_size) 
-       )
+    if (!bini_hdr_ok(&hdr))
     {
         // wrong INI file header
         return BINI_ERR_FILE;
@@ -112,11 +246,7 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length)
             return BINI_ERR_IO;
         }
         // validate it's fields
-        if ( (app.zero != 0)                            || 
-             (app.name_length[0] != app.name_length[1]) || 
-             (app.key_offset >= hdr.file_size)          || 
-             (app.name_offset >= hdr.file_size) 
-           )
+        if (!bini_app_ok(&app, &hdr))
         {
             // wrong APP content
             return BINI_ERR_FILE;
@@ -143,17 +273,11 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length)
                     return BINI_ERR_IO;
                 }
                 // validate KEY fields
-                if ( (key.zero != 0)                            || 
-                     (key.name_length[0] != key.name_length[1]) ||
-                     (key.val_length[0] != key.val_length[1])   ||
-                     (key.name_offset > hdr.file_size)          ||
-                     (key.val_offset  > hdr.file_size)
-                   )
+                if (!bini_key_ok(&key, &hdr))
                 {
                     return BINI_ERR_FILE;
                 }
-                // check the buffer size is enough for KEY name and value
-                if ((key.name_length[0] + key.val_length[0]) > length)
+                if (key.name_length[0] > length)
                 {
                     return BINI_ERR_MEM;
                 }
@@ -161,13 +285,29 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length)
                 {
                     return BINI_ERR_IO;
                 }
-                if (BINI_SUCCESS != BINI_READ_FILE_AT(hf, key.val_offset, (void*)(buf + key.name_length[0]), key.val_length[0]))
+#ifdef BINI_PROCESS_KEY_NAME
+                // pass KEY name to application, value is read only if needed
+                action = BINI_PROCESS_KEY_NAME(hf, buf);
+                if ((BINI_DO_KEYS != action) && (BINI_SKIP_KEY != action))
                 {
-                    return BINI_ERR_IO;
+                    break;
                 }
-                if (BINI_DO_KEYS != BINI_PROCESS_KEY(hf, buf, buf + key.name_length[0], key.val_length[0]))
+#endif
+                if (BINI_DO_KEYS == action)
                 {
-                    break;
+                    // check the buffer size is enough for KEY name and value
+                    if ((key.name_length[0] + key.val_length[0]) > length)
+                    {
+                        return BINI_ERR_MEM;
+                    }
+                    if (BINI_SUCCESS != BINI_READ_FILE_AT(hf, key.val_offset, (void*)(buf + key.name_length[0]), key.val_length[0]))
+                    {
+                        return BINI_ERR_IO;
+                    }
+                    if (BINI_DO_KEYS != BINI_PROCESS_KEY(hf, buf, buf + key.name_length[0], key.val_length[0]))
+                    {
+                        break;
+                    }
                 }
                 // next KEY
                 key_offset = key.next_key;
@@ -182,4 +322,387 @@ int read_bini(void* inst, uint8_t *buf, uint32_t length)
     }
     return BINI_SUCCESS;
 }
+#endif // BINI_READ_FILE_AT
+
+// string of len bytes at offset must be within the file and zero-terminated
+static int bini_str_ok(const uint8_t *image, uint32_t file_size, uint32_t offset, uint16_t len)
+{
+    return len && (offset < file_size) && (len <= file_size - offset) && !image[offset + len - 1];
+}
+
+// copy and validate header of the image
+static int bini_mem_hdr(const uint8_t *image, uint32_t size, bini_hdr_t *hdr)
+{
+    if (size < sizeof(bini_hdr_t))
+    {
+        return 0;
+    }
+    // records may be unaligned, they are copied, names and values are not
+    memcpy(hdr, image, sizeof(bini_hdr_t));
+    return bini_hdr_ok(hdr) && (hdr->file_size <= size);
+}
+
+// copy and validate APP at offset of the image, with its name
+static int bini_mem_app(const uint8_t *image, const bini_hdr_t *hdr, uint32_t offset, bini_app_t *app)
+{
+    if ((offset > hdr->file_size) || (hdr->file_size - offset < sizeof(bini_app_t)))
+    {
+        return 0;
+    }
+    memcpy(app, image + offset, sizeof(bini_app_t));
+    return bini_app_ok(app, hdr) && bini_str_ok(image, hdr->file_size, app->name_offset, app->name_length[0]);
+}
+
+// copy and validate KEY at offset of the image, with its name and value
+static int bini_mem_key(const uint8_t *image, const bini_hdr_t *hdr, uint32_t offset, bini_key_t *key)
+{
+    if ((offset > hdr->file_size) || (hdr->file_size - offset < sizeof(bini_key_t)))
+    {
+        return 0;
+    }
+    memcpy(key, image + offset, sizeof(bini_key_t));
+    return bini_key_ok(key, hdr) && 
+           bini_str_ok(image, hdr->file_size, key->name_offset, key->name_length[0]) &&
+           (key->val_length[0] <= hdr->file_size - key->val_offset);
+}
+
+int read_bini_mem(void* inst, const uint8_t *image, uint32_t size)
+{
+    FILE_HANDLE hf = (FILE_HANDLE)inst;
+    bini_hdr_t  hdr;
+    bini_app_t  app;
+    uint32_t    app_offset;
+    bini_key_t  key;
+    uint32_t    key_offset;
+    uint32_t    records;
+    int         action = BINI_DO_KEYS;
+
+    if (!bini_mem_hdr(image, size, &hdr))
+    {
+        // wrong INI file header or file is cut
+        return BINI_ERR_FILE;
+    }
+    // more records than fit into the file means the lists are looped
+    records = hdr.file_size / sizeof(bini_app_t);
+    // traverse the list of all APPs
+    app_offset = hdr.first_app;
+
+    while (app_offset)
+    {
+        if (!records-- || !bini_mem_app(image, &hdr, app_offset, &app))
+        {
+            // wrong APP content
+            return BINI_ERR_FILE;
+        }
+        // pass APP name to application for processing decision
+        if (BINI_DO_KEYS == BINI_PROCESS_APP(hf, (uint8_t*)image + app.name_offset))
+        {
+            // KEYs processing requested, traverse the list
+            key_offset = app.key_offset;
+            while (key_offset)
+            {
+                // validate KEY fields, value must be within the file too
+                if (!records-- || !bini_mem_key(image, &hdr, key_offset, &key))
+                {
+                    return BINI_ERR_FILE;
+                }
+#ifdef BINI_PROCESS_KEY_NAME
+                action = BINI_PROCESS_KEY_NAME(hf, (uint8_t*)image + key.name_offset);
+                if ((BINI_DO_KEYS != action) && (BINI_SKIP_KEY != action))
+                {
+                    break;
+                }
+#endif
+                if ( (BINI_DO_KEYS == action) &&
+                     (BINI_DO_KEYS != BINI_PROCESS_KEY(hf, (uint8_t*)image + key.name_offset, 
+                                                       (uint8_t*)image + key.val_offset, key.val_length[0]))
+                   )
+                {
+                    break;
+                }
+                // next KEY
+                key_offset = key.next_key;
+            }
+        }
+        // next APP
+        app_offset = app.next_app;
+    }
+    return BINI_SUCCESS;
+}
+
+// FNV-1a hash of APP and KEY names
+static uint32_t bini_hash(const char *app, const char *key)
+{
+    uint32_t h = 2166136261UL;
+
+    do
+    {
+        h = (h ^ (uint8_t)*app) * 16777619UL;
+    } while (*app++);
+    do
+    {
+        h = (h ^ (uint8_t)*key) * 16777619UL;
+    } while (*key++);
+    return h;
+}
+
+// slot of APP and KEY names, free slot if they are not in the index
+static bini_slot_t *bini_find(const bini_index_t *idx, uint32_t h, const char *app, const char *key)
+{
+    bini_slot_t *s;
+    bini_app_t   a;
+    bini_key_t   k;
+    uint32_t     i;
+
+    for (i = h & idx->mask; ; i = (i + 1) & idx->mask)
+    {
+        s = &idx->slot[i];
+        if (!s->key_offset)
+        {
+            return s;
+        }
+        if (s->hash == h)
+        {
+            // records were checked by bini_index_build
+            memcpy(&a, idx->image + s->app_offset, sizeof(bini_app_t));
+            memcpy(&k, idx->image + s->key_offset, sizeof(bini_key_t));
+            if ( !strcmp((const char*)idx->image + k.name_offset, key) &&
+                 !strcmp((const char*)idx->image + a.name_offset, app)
+               )
+            {
+                return s;
+            }
+        }
+    }
+}
+
+// traverse the lists of the image, counting KEYs and adding them to the index if any
+static int bini_index_walk(bini_index_t *idx, const uint8_t *image, uint32_t size, uint32_t *keys)
+{
+    bini_hdr_t   hdr;
+    bini_app_t   app;
+    uint32_t     app_offset;
+    bini_key_t   key;
+    uint32_t     key_offset;
+    uint32_t     records, h;
+    bini_slot_t *s;
+
+    *keys = 0;
+    if (!bini_mem_hdr(image, size, &hdr))
+    {
+        return BINI_ERR_FILE;
+    }
+    records = hdr.file_size / sizeof(bini_app_t);
+    for (app_offset = hdr.first_app; app_offset; app_offset = app.next_app)
+    {
+        if (!records-- || !bini_mem_app(image, &hdr, app_offset, &app))
+        {
+            return BINI_ERR_FILE;
+        }
+        for (key_offset = app.key_offset; key_offset; key_offset = key.next_key)
+        {
+            if (!records-- || !bini_mem_key(image, &hdr, key_offset, &key))
+            {
+                return BINI_ERR_FILE;
+            }
+            (*keys)++;
+            if (!idx)
+            {
+                continue;
+            }
+            // slots are kept at least half free for short probes
+            if (*keys > (idx->mask + 1) / 2)
+            {
+                return BINI_ERR_MEM;
+            }
+            h = bini_hash((const char*)image + app.name_offset, (const char*)image + key.name_offset);
+            s = bini_find(idx, h, (const char*)image + app.name_offset, (const char*)image + key.name_offset);
+            // repeated KEY is found at its first place, as by read_bini
+            if (!s->key_offset)
+            {
+                s->hash = h;
+                s->app_offset = app_offset;
+                s->key_offset = key_offset;
+                idx->keys++;
+            }
+        }
+    }
+    return BINI_SUCCESS;
+}
+
+uint32_t bini_index_slots(const uint8_t *image, uint32_t size)
+{
+    uint32_t keys, count;
+
+    if (BINI_SUCCESS != bini_index_walk(NULL, image, size, &keys))
+    {
+        return 0;
+    }
+    for (count = 16; count < keys * 2; count <<= 1);
+    return count;
+}
+
+int bini_index_build(bini_index_t *idx, const uint8_t *image, uint32_t size, bini_slot_t *slots, uint32_t count)
+{
+    uint32_t keys;
+    int      rc;
+
+    memset(idx, 0, sizeof(bini_index_t));
+    if (count < 2)
+    {
+        return BINI_ERR_MEM;
+    }
+    // power of two slots are used
+    for (idx->mask = 1; idx->mask <= count / 2; idx->mask <<= 1);
+    idx->mask--;
+    memset(slots, 0, (idx->mask + 1) * sizeof(bini_slot_t));
+    idx->image = image;
+    idx->slot = slots;
+    rc = bini_index_walk(idx, image, size, &keys);
+    if (rc != BINI_SUCCESS)
+    {
+        // index is unusable
+        idx->slot = NULL;
+    }
+    return rc;
+}
+
+const uint8_t *bini_lookup(const bini_index_t *idx, const char *app, const char *key, uint16_t *val_length)
+{
+    bini_slot_t *s;
+    bini_key_t   k;
+
+    if (!idx->slot)
+    {
+        return NULL;
+    }
+    s = bini_find(idx, bini_hash(app, key), app, key);
+    if (!s->key_offset)
+    {
+        return NULL;
+    }
+    memcpy(&k, idx->image + s->key_offset, sizeof(bini_key_t));
+    *val_length = k.val_length[0];
+    return idx->image + k.val_offset;
+}
+
+// size of INI-file image of the model
+uint32_t bini_image_size(const bini_wapp_t *apps, uint32_t count)
+{
+    uint64_t    size = sizeof(bini_hdr_t);
+    size_t      len;
+    uint32_t    i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        len = strlen(apps[i].name) + 1;
+        if (len > 0xFFFF)
+        {
+            return 0;
+        }
+        size += sizeof(bini_app_t) + len;
+        for (j = 0; j < apps[i].key_count; j++)
+        {
+            len = strlen(apps[i].keys[j].name) + 1;
+            if (len > 0xFFFF)
+            {
+                return 0;
+            }
+            size += sizeof(bini_key_t) + len + apps[i].keys[j].val_length;
+        }
+    }
+    if (size > 0xFFFFFFFFUL)
+    {
+        return 0;
+    }
+    return (uint32_t)size;
+}
+
+uint32_t bini_build_image(const bini_wapp_t *apps, uint32_t count, uint8_t *buf, uint32_t length)
+{
+    const bini_wkey_t  *wk;
+    bini_hdr_t  hdr;
+    bini_app_t  app;
+    uint32_t    app_offset;
+    bini_key_t  key;
+    uint32_t    key_offset;
+    uint32_t    size, pos, i, j;
+    uint16_t    len;
+
+    size = bini_image_size(apps, count);
+    if (!size || (size > length))
+    {
+        return 0;
+    }
+    memset(&hdr, 0, sizeof(bini_hdr_t));
+    hdr.signature = BINI_SIGNATURE;
+    hdr.first_app = count ? sizeof(bini_hdr_t) : 0;
+    hdr.file_size = size;
+    memcpy(buf, &hdr, sizeof(bini_hdr_t));
+    pos = sizeof(bini_hdr_t);
+    for (i = 0; i < count; i++)
+    {
+        // APP, its name, then its KEYs
+        memset(&app, 0, sizeof(bini_app_t));
+        app_offset = pos;
+        pos += sizeof(bini_app_t);
+        len = (uint16_t)(strlen(apps[i].name) + 1);
+        app.name_length[0] = app.name_length[1] = len;
+        app.name_offset = pos;
+        memcpy(buf + pos, apps[i].name, len);
+        pos += len;
+        app.key_offset = apps[i].key_count ? pos : 0;
+        for (j = 0; j < apps[i].key_count; j++)
+        {
+            // KEY, its name and value
+            wk = &apps[i].keys[j];
+            memset(&key, 0, sizeof(bini_key_t));
+            key_offset = pos;
+            pos += sizeof(bini_key_t);
+            len = (uint16_t)(strlen(wk->name) + 1);
+            key.name_length[0] = key.name_length[1] = len;
+            key.name_offset = pos;
+            memcpy(buf + pos, wk->name, len);
+            pos += len;
+            key.val_length[0] = key.val_length[1] = wk->val_length;
+            key.val_offset = pos;
+            if (wk->val_length)
+            {
+                memcpy(buf + pos, wk->val, wk->val_length);
+            }
+            pos += wk->val_length;
+            key.next_key = (j + 1 < apps[i].key_count) ? pos : 0;
+            memcpy(buf + key_offset, &key, sizeof(bini_key_t));
+        }
+        app.next_app = (i + 1 < count) ? pos : 0;
+        memcpy(buf + app_offset, &app, sizeof(bini_app_t));
+    }
+    return size;
+}
+
+#ifdef BINI_WRITE_FILE
+int write_bini(void* inst, const bini_wapp_t *apps, uint32_t count, uint8_t *buf, uint32_t length)
+{
+    FILE_HANDLE hf = (FILE_HANDLE)inst;
+    uint32_t    size;
+
+    size = bini_image_size(apps, count);
+    if (!size)
+    {
+        // names are too long or file is too big
+        return BINI_ERR_FILE;
+    }
+    if (size > length)
+    {
+        return BINI_ERR_MEM;
+    }
+    bini_build_image(apps, count, buf, length);
+    // whole file in one write
+    if (BINI_SUCCESS != BINI_WRITE_FILE(hf, buf, size))
+    {
+        return BINI_ERR_IO;
+    }
+    return BINI_SUCCESS;
+}
+#endif // BINI_WRITE_FILE
 #endif // BINI_IMPLEMENT
@@ -0,0 +1,302 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Compaction of OS/2 binary INI files.
+// File is traversed by read_bini_mem into a model of all APPs and KEYs, then
+// written by write_bini with no dead space and each APP, its KEYs, names and
+// values in traversal order. Both files are scanned by read_bini through
+// fseek/fread to compare seek distances and scan times.
+
+struct scan_s;
+
+// required definitions, see bini.h
+#define FILE_HANDLE                         struct scan_s*
+#define BINI_SUCCESS                        0
+#define BINI_DO_KEYS                        1
+#define BINI_ERR_MEM                        3
+#define BINI_ERR_FILE                       4
+#define BINI_ERR_IO                         5
+
+int read_file_at(struct scan_s *sc, uint32_t file_pos, uint8_t *buf, uint32_t len);
+#define BINI_READ_FILE_AT(hf, pos, buf, len) read_file_at((hf), (pos), (buf), (len))
+int write_file(struct scan_s *sc, uint8_t *buf, uint32_t len);
+#define BINI_WRITE_FILE(hf, buf, len)        write_file((hf), (buf), (len))
+int process_app(struct scan_s *sc, uint8_t *app);
+#define BINI_PROCESS_APP(hf, app)            process_app((hf), (app))
+int process_key(struct scan_s *sc, uint8_t *key, uint8_t *val, uint32_t val_len);
+#define BINI_PROCESS_KEY(hf, key, val, len)  process_key((hf), (key), (val), (len))
+
+#define BINI_IMPLEMENT
+#include "bini.h"
+
+#define BUF_SIZE                            65536UL
+
+// state of one traversal
+typedef struct scan_s
+{
+    FILE           *f;
+    uint32_t        pos;         // file position after the last read
+    uint64_t        seek;        // sum of distances between reads
+    uint32_t        reads;
+    uint32_t        seeks;       // reads not at the position of the previous end
+    // model, filled at load only
+    bini_wapp_t    *apps;
+    uint32_t        app_count;
+    uint32_t        app_max;
+    bini_wkey_t    *keys;
+    uint32_t        key_count;
+    uint32_t        key_max;
+    uint32_t       *first_key;   // index of the first KEY of each APP
+    int             load;
+} scan_t;
+
+static uint8_t buffer[BUF_SIZE];
+
+int read_file_at(scan_t *sc, uint32_t file_pos, uint8_t *buf, uint32_t len)
+{
+    sc->seek += (file_pos > sc->pos) ? file_pos - sc->pos : sc->pos - file_pos;
+    sc->seeks += (file_pos != sc->pos);
+    sc->reads++;
+    if (fseek(sc->f, file_pos, SEEK_SET))
+    {
+        return BINI_ERR_IO;
+    }
+    if (len && (!fread(buf, len, 1, sc->f)))
+    {
+        return BINI_ERR_IO;
+    }
+    sc->pos = file_pos + len;
+    return BINI_SUCCESS;
+}
+
+int write_file(scan_t *sc, uint8_t *buf, uint32_t len)
+{
+    return (len == fwrite(buf, 1, len, sc->f)) ? BINI_SUCCESS : BINI_ERR_IO;
+}
+
+int process_app(scan_t *sc, uint8_t *app)
+{
+    bini_wapp_t *apps;
+    uint32_t *first;
+    uint32_t max;
+
+    if (sc->load < 0)
+    {
+        return BINI_SUCCESS;
+    }
+    if (!sc->load)
+    {
+        return BINI_DO_KEYS;
+    }
+    if (sc->app_count == sc->app_max)
+    {
+        max = sc->app_max ? sc->app_max * 2 : 256;
+        apps = (bini_wapp_t *)realloc(sc->apps, max * sizeof(bini_wapp_t));
+        if (apps)
+        {
+            sc->apps = apps;
+        }
+        first = (uint32_t *)realloc(sc->first_key, max * sizeof(uint32_t));
+        if (first)
+        {
+            sc->first_key = first;
+        }
+        if (!apps || !first)
+        {
+            // model stays incomplete
+            sc->load = -1;
+            return BINI_SUCCESS;
+        }
+        sc->app_max = max;
+    }
+    // names and values stay in the loaded image
+    sc->apps[sc->app_count].name = (const char *)app;
+    sc->apps[sc->app_count].key_count = 0;
+    sc->first_key[sc->app_count] = sc->key_count;
+    sc->app_count++;
+    return BINI_DO_KEYS;
+}
+
+int process_key(scan_t *sc, uint8_t *key, uint8_t *val, uint32_t val_len)
+{
+    bini_wkey_t *keys;
+
+    if (sc->load < 0)
+    {
+        return BINI_SUCCESS;
+    }
+    if (!sc->load)
+    {
+        return BINI_DO_KEYS;
+    }
+    if (sc->key_count == sc->key_max)
+    {
+        sc->key_max = sc->key_max ? sc->key_max * 2 : 1024;
+        keys = (bini_wkey_t *)realloc(sc->keys, sc->key_max * sizeof(bini_wkey_t));
+        if (!keys)
+        {
+            sc->load = -1;
+            return BINI_SUCCESS;
+        }
+        sc->keys = keys;
+    }
+    sc->keys[sc->key_count].name = (const char *)key;
+    sc->keys[sc->key_count].val = val;
+    sc->keys[sc->key_count].val_length = (uint16_t)val_len;
+    sc->key_count++;
+    sc->apps[sc->app_count - 1].key_count++;
+    return BINI_DO_KEYS;
+}
+
+static uint8_t *load_file(const char *name, uint32_t *size)
+{
+    uint8_t *data = NULL;
+    FILE *f;
+    long len;
+
+    f = fopen(name, "rb");
+    if (!f)
+    {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len > 0)
+    {
+        data = (uint8_t *)malloc(len);
+    }
+    if (data && (len != (long)fread(data, 1, len, f)))
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = (uint32_t)len;
+    return data;
+}
+
+// traverse all APPs and KEYs of the file repeat times, seek stats of one traversal
+static int scan_file(const char *name, uint32_t repeat, scan_t *sc, double *t)
+{
+    struct timespec t0, t1;
+    uint32_t r;
+    int rc = BINI_SUCCESS;
+
+    memset(sc, 0, sizeof(scan_t));
+    *t = 0;
+    for (r = 0; (r < repeat) && (rc == BINI_SUCCESS); r++)
+    {
+        // every scan from a freshly opened file
+        sc->f = fopen(name, "rb");
+        if (!sc->f)
+        {
+            return BINI_ERR_IO;
+        }
+        sc->pos = 0;
+        sc->seek = 0;
+        sc->reads = sc->seeks = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        rc = read_bini(sc, buffer, BUF_SIZE);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        fclose(sc->f);
+        *t += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+    *t /= repeat;
+    return rc;
+}
+
+static void print_scan(const char *what, uint32_t size, const scan_t *sc, double t)
+{
+    fprintf(stdout, "%s: %u bytes, %u reads, %u seeks, average seek %.1f bytes, scan %.3f ms\n", what, size,
+            sc->reads, sc->seeks, sc->reads ? (double)sc->seek / sc->reads : 0.0, t * 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    scan_t sc, before, after;
+    uint8_t *image = NULL, *res = NULL;
+    uint32_t size = 0, out_size, repeat = 10, i;
+    int arg = 1, rc = 0;
+    double t_before, t_after;
+
+    memset(&sc, 0, sizeof(sc));
+    if ((argc > 2) && !strcmp(argv[1], "-r"))
+    {
+        repeat = atoi(argv[2]);
+        arg += 2;
+    }
+    if ((argc - arg != 2) || !repeat)
+    {
+        fprintf(stdout, "USAGE: %s [-r <repeat>] <input INI file> <output INI file>\n"
+                        "  -r - scans of each file for timing, 10 by default\n", argv[0]);
+        return 1;
+    }
+    image = load_file(argv[arg], &size);
+    if (!image)
+    {
+        fprintf(stderr, "Error to read file %s\n", argv[arg]);
+        return 2;
+    }
+    sc.load = 1;
+    rc = read_bini_mem(&sc, image, size);
+    if ((rc == BINI_SUCCESS) && (sc.load < 0))
+    {
+        rc = BINI_ERR_MEM;
+    }
+    if (rc != BINI_SUCCESS)
+    {
+        fprintf(stderr, "File %s is incorrect or too big, error %d\n", argv[arg], rc);
+        rc = 4;
+        goto end;
+    }
+    for (i = 0; i < sc.app_count; i++)
+    {
+        sc.apps[i].keys = sc.keys + sc.first_key[i];
+    }
+    out_size = bini_image_size(sc.apps, sc.app_count);
+    res = out_size ? (uint8_t *)malloc(out_size) : NULL;
+    if (!res)
+    {
+        fprintf(stderr, "Not enough memory\n");
+        rc = 4;
+        goto end;
+    }
+    sc.f = fopen(argv[arg + 1], "wb");
+    if (!sc.f)
+    {
+        fprintf(stderr, "Error to create file %s\n", argv[arg + 1]);
+        rc = 3;
+        goto end;
+    }
+    rc = write_bini(&sc, sc.apps, sc.app_count, res, out_size);
+    if ((rc != BINI_SUCCESS) | fclose(sc.f))
+    {
+        fprintf(stderr, "Error to write file %s\n", argv[arg + 1]);
+        rc = 5;
+        goto end;
+    }
+    fprintf(stdout, "%u APPs, %u KEYs, %u bytes of dead space removed\n", sc.app_count, sc.key_count,
+            (size > out_size) ? size - out_size : 0);
+    if ( (scan_file(argv[arg], repeat, &before, &t_before) != BINI_SUCCESS) ||
+         (scan_file(argv[arg + 1], repeat, &after, &t_after) != BINI_SUCCESS)
+       )
+    {
+        fprintf(stderr, "Error to scan files\n");
+        rc = 4;
+        goto end;
+    }
+    print_scan("before", size, &before, t_before);
+    print_scan("after ", out_size, &after, t_after);
+
+end:
+    free(image);
+    free(res);
+    free(sc.apps);
+    free(sc.keys);
+    free(sc.first_key);
+    return rc;
+}
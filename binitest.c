@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // required definitions
@@ -10,6 +11,7 @@
 // Error codes, returned at INI processing
 #define BINI_SUCCESS                        0
 #define BINI_DO_KEYS                        1
+#define BINI_SKIP_KEY                       2
 #define BINI_ERR_MEM                        3
 #define BINI_ERR_FILE                       4
 #define BINI_ERR_IO                         5
@@ -26,6 +28,10 @@ int process_app(FILE *f, uint8_t *app);
 // must return !0 - continue KEYs processing for that APP, 0 - goto next APP
 int process_key(FILE *f, uint8_t *key, uint8_t *val, uint32_t val_len);
 #define BINI_PROCESS_KEY(hf, key, val, len)  process_key((hf), (key), (val), (len))
+// callback from parser into application, passes file handle and KEY name string,
+// must return BINI_DO_KEYS - read the value, BINI_SKIP_KEY - goto next KEY
+int process_key_name(FILE *f, uint8_t *key);
+#define BINI_PROCESS_KEY_NAME(hf, key)       process_key_name((hf), (key))
 
 #define BINI_IMPLEMENT
 #include "bini.h"
@@ -38,6 +44,7 @@ int  ret;
 uint8_t  buffer[BUF_SIZE];
 uint8_t  *user_app = NULL; 
 uint8_t  *user_key = NULL;
+uint8_t  *image = NULL;          // whole file for read_bini_mem
 
 int read_file_at(FILE * f, uint32_t file_pos, uint8_t *buf, uint32_t len)
 {
@@ -74,6 +81,33 @@ int process_app(FILE *f, uint8_t *app)
     return BINI_SUCCESS;
 }
 
+void print_key(const uint8_t *key, const uint8_t *val, uint32_t val_len)
+{
+    fprintf( stdout, "    %s\n", key); 
+    fprintf( stdout, "        ");
+    // limit output to reasonable length
+    if (val_len > 16) 
+    {
+        val_len = 16;
+    }
+    while (val_len--)
+    {
+        fprintf( stdout, "0x%02hx ", *val++);
+    }
+    fprintf( stdout, "\n");
+}
+
+int process_key_name(FILE *f, uint8_t *key)
+{
+    (void)f;
+    // value of other KEYs is not needed
+    if (user_key && strcmp((const char *)user_key, (const char *)key))
+    {
+        return BINI_SKIP_KEY;
+    }
+    return BINI_DO_KEYS;
+}
+
 int process_key(FILE *f, uint8_t *key, uint8_t *val, uint32_t val_len)
 {
     // specific KEY was requested?
@@ -86,18 +120,7 @@ int process_key(FILE *f, uint8_t *key, uint8_t *val, uint32_t val_len)
             return BINI_DO_KEYS;
         }
         // yes, it is
-        fprintf( stdout, "    %s\n", key); 
-        fprintf( stdout, "        ");
-        // limit output to reasonable length
-        if (val_len > 16) 
-        {
-            val_len = 16;
-        }
-        while (val_len--)
-        {
-            fprintf( stdout, "0x%02hx ", *val++);
-        }
-        fprintf( stdout, "\n");
+        print_key(key, val, val_len);
         return BINI_SUCCESS;
     }
     else
@@ -108,30 +131,101 @@ int process_key(FILE *f, uint8_t *key, uint8_t *val, uint32_t val_len)
     }
 }
 
+// read whole file into memory
+static uint8_t *load_file(FILE *f, uint32_t *size)
+{
+    uint8_t *data = NULL;
+    long len;
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len > 0)
+    {
+        data = (uint8_t*)malloc(len);
+    }
+    if (data && (len != (long)fread(data, 1, len, f)))
+    {
+        free(data);
+        data = NULL;
+    }
+    *size = (uint32_t)len;
+    return data;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    bini_index_t idx;
+    bini_slot_t *slots;
+    const uint8_t *val;
+    uint16_t val_len;
+    uint32_t size, count;
+    int arg = 1, mem = 0;
+
+    if ((argc > 1) && !strcmp(argv[1], "-m"))
+    {
+        // whole file in memory, no reads per record
+        mem = 1;
+        arg++;
+    }
+    else if ((argc > 1) && !strcmp(argv[1], "-i"))
+    {
+        // whole file in memory, KEY is looked up in its index
+        mem = 2;
+        arg++;
+    }
+    if ((argc - arg < 1) || ((mem == 2) && (argc - arg < 3)))
     {
-        fprintf(stderr, "USAGE: %s <ini-file> [<app-name>] [[<value-name>]]\n", argv[0]);
+        fprintf(stderr, "USAGE: %s [-m | -i] <ini-file> [<app-name>] [[<value-name>]]\n"
+                        "  -m - read whole file into memory and parse it there\n"
+                        "  -i - read whole file into memory and look up the value in its index,\n"
+                        "       app and value names are required\n", argv[0]);
         return 1;
     }
-    if (argc > 2)
+    if (argc - arg > 1)
     {
         // if app name supplied, take it
-        user_app = (uint8_t*)argv[2]; 
+        user_app = (uint8_t*)argv[arg + 1]; 
     }
-    if (argc > 3)
+    if (argc - arg > 2)
     {
         // if key name supplied, take it
-        user_key = (uint8_t*)argv[3]; 
+        user_key = (uint8_t*)argv[arg + 2]; 
     }
-    ini = fopen(argv[1], "rb");
+    ini = fopen(argv[arg], "rb");
     if (!ini)
     {
-        fprintf(stderr, "Can't open file: %s\n", argv[1]);
+        fprintf(stderr, "Can't open file: %s\n", argv[arg]);
         return 2;
     }
-    ret = read_bini(ini, buffer, BUF_SIZE);
+    if (mem == 2)
+    {
+        image = load_file(ini, &size);
+        count = image ? bini_index_slots(image, size) : 0;
+        slots = count ? (bini_slot_t*)malloc(count * sizeof(bini_slot_t)) : NULL;
+        ret = slots ? bini_index_build(&idx, image, size, slots, count) : (image ? BINI_ERR_FILE : BINI_ERR_IO);
+        if (BINI_SUCCESS == ret)
+        {
+            val = bini_lookup(&idx, (const char*)user_app, (const char*)user_key, &val_len);
+            if (val)
+            {
+                fprintf(stdout, "%s\n", user_app);
+                print_key(user_key, val, val_len);
+            }
+        }
+        free(slots);
+        free(image);
+    }
+    else if (mem)
+    {
+        image = load_file(ini, &size);
+        ret = image ? read_bini_mem(ini, image, size) : BINI_ERR_IO;
+        free(image);
+    }
+    else
+    {
+        ret = read_bini(ini, buffer, BUF_SIZE);
+    }
     fclose(ini);
 
     fprintf(stderr, "\n");
@@ -146,7 +240,7 @@ int main(int argc, char *argv[])
             break;
 
         case BINI_ERR_FILE:
-            fprintf(stderr, "File %s is incorrect\n", argv[1]); 
+            fprintf(stderr, "File %s is incorrect\n", argv[arg]); 
             break;
 
         default:
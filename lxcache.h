@@ -0,0 +1,399 @@
+// SPDX-License-Identifier: MIT
+#ifndef __H_LX_CACHE__
+#define __H_LX_CACHE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include "lxmodule.h"
+
+// On-demand cache of unpacked LX pages on the host (pthreads).
+// Page is unpacked on its first access only and stays in a bounded LRU cache.
+// Cache is split into shards by the page key, each with own lock and LRU list,
+// so readers of different pages do not wait for each other and no global lock
+// is taken. Page is unpacked with the shard unlocked, readers of the same page
+// wait for it. Requires LX_MODULE_IMPLEMENTATION and LX_UNPACK_IMPLEMENTATION.
+
+#define LX_CACHE_SHARDS                16      // at most, small caches use fewer
+
+typedef struct lx_centry_s lx_centry_t;
+
+// one shard of the cache
+typedef struct lx_cshard_s
+{
+    pthread_mutex_t     lock;
+    pthread_cond_t      loaded;  // signalled when a page is unpacked
+    lx_centry_t       **hash;    // buckets of the page keys
+    uint32_t            mask;    // number of buckets - 1
+    lx_centry_t        *head;    // most recently used page
+    lx_centry_t        *tail;    // least recently used page
+    uint32_t            count;   // pages allocated
+    uint32_t            limit;   // pages allowed
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            evictions;
+} lx_cshard_t;
+
+typedef struct lx_cache_s
+{
+    lx_cshard_t         shard[LX_CACHE_SHARDS];
+    uint32_t            shards;  // shards in use, each allowed at least one page
+} lx_cache_t;
+
+// cache counters
+typedef struct lx_cache_stats_s
+{
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            evictions;
+    uint32_t            pages;   // pages held now
+    uint64_t            bytes;   // memory held by them
+} lx_cache_stats_t;
+
+// create cache for up to max_pages unpacked pages (at least one). More pages are
+// held only while all of them are in use
+int lx_cache_init(lx_cache_t *cache, uint32_t max_pages);
+// free all pages, none may be in use
+void lx_cache_done(lx_cache_t *cache);
+// unpacked page (0-based within 0-based object) of the module, NULL on error.
+// Page stays valid and is not evicted until lx_cache_release. Page failed to
+// unpack is not kept, next call tries it again
+const uint8_t *lx_cache_get(lx_cache_t *cache, const lx_module_t *mod, uint32_t obj, uint32_t page);
+// end of the page use
+void lx_cache_release(lx_cache_t *cache, const uint8_t *data);
+// drop all unused pages of the module, before it is closed
+void lx_cache_forget(lx_cache_t *cache, const lx_module_t *mod);
+// counters summed over all shards
+void lx_cache_stats(lx_cache_t *cache, lx_cache_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef LX_CACHE_IMPLEMENTATION
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// entry result while the page is being unpacked
+#define LX_CACHE_LOADING               1
+
+struct lx_centry_s
+{
+    lx_centry_t        *hnext;   // next in the bucket
+    lx_centry_t        *prev;    // LRU list neighbours
+    lx_centry_t        *next;
+    const lx_module_t  *mod;     // page key
+    uint32_t            obj;
+    uint32_t            page;
+    uint32_t            hash;
+    uint32_t            refs;    // users of the page
+    int                 rc;      // LX_MOD_xxx or LX_CACHE_LOADING
+    uint8_t             data[LX_PAGE_SIZE];
+};
+
+// shard is chosen by the high bits of the key hash, bucket by the low ones
+#define LX_CACHE_SHARD(cache, hash)    (&(cache)->shard[((hash) >> 24) % (cache)->shards])
+
+static uint32_t lx_cache_hash(const lx_module_t *mod, uint32_t obj, uint32_t page)
+{
+    uint64_t h = (uint64_t)(uintptr_t)mod * 0x9E3779B97F4A7C15ULL;
+
+    h ^= ((uint64_t)obj << 32 | page) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// remove page from the LRU list
+static void lx_cache_unlink(lx_cshard_t *sh, lx_centry_t *e)
+{
+    if (e->prev)
+    {
+        e->prev->next = e->next;
+    }
+    else
+    {
+        sh->head = e->next;
+    }
+    if (e->next)
+    {
+        e->next->prev = e->prev;
+    }
+    else
+    {
+        sh->tail = e->prev;
+    }
+}
+
+// make page most recently used
+static void lx_cache_push(lx_cshard_t *sh, lx_centry_t *e)
+{
+    e->prev = NULL;
+    e->next = sh->head;
+    if (sh->head)
+    {
+        sh->head->prev = e;
+    }
+    else
+    {
+        sh->tail = e;
+    }
+    sh->head = e;
+}
+
+// remove page from its bucket
+static void lx_cache_unhash(lx_cshard_t *sh, lx_centry_t *e)
+{
+    lx_centry_t **p;
+
+    for (p = &sh->hash[e->hash & sh->mask]; *p != e; p = &(*p)->hnext);
+    *p = e->hnext;
+}
+
+// create cache for up to max_pages unpacked pages
+int lx_cache_init(lx_cache_t *cache, uint32_t max_pages)
+{
+    lx_cshard_t *sh;
+    uint32_t i, buckets;
+
+    memset(cache, 0, sizeof(*cache));
+    if (!max_pages)
+    {
+        max_pages = 1;
+    }
+    // pages are split exactly, small cache has fewer shards
+    cache->shards = (max_pages < LX_CACHE_SHARDS) ? max_pages : LX_CACHE_SHARDS;
+    for (i = 0; i < cache->shards; i++)
+    {
+        sh = &cache->shard[i];
+        sh->limit = max_pages / cache->shards + (i < max_pages % cache->shards);
+        for (buckets = 16; buckets < sh->limit; buckets <<= 1);
+        sh->mask = buckets - 1;
+        sh->hash = (lx_centry_t **)calloc(buckets, sizeof(lx_centry_t *));
+        if (!sh->hash)
+        {
+            lx_cache_done(cache);
+            return LX_MOD_ERR_MEM;
+        }
+        pthread_mutex_init(&sh->lock, NULL);
+        pthread_cond_init(&sh->loaded, NULL);
+    }
+    return LX_MOD_OK;
+}
+
+// free all pages, none may be in use
+void lx_cache_done(lx_cache_t *cache)
+{
+    lx_cshard_t *sh;
+    lx_centry_t *e;
+    uint32_t i;
+
+    for (i = 0; i < cache->shards; i++)
+    {
+        sh = &cache->shard[i];
+        if (!sh->hash)
+        {
+            continue;
+        }
+        while ((e = sh->head) != NULL)
+        {
+            sh->head = e->next;
+            free(e);
+        }
+        free(sh->hash);
+        sh->hash = NULL;
+        pthread_cond_destroy(&sh->loaded);
+        pthread_mutex_destroy(&sh->lock);
+    }
+}
+
+// unpack the page into the entry
+static int lx_cache_load(lx_centry_t *e)
+{
+    const lx_module_t *mod = e->mod;
+    const lx_obj_t *obj;
+
+    if ((e->obj >= mod->hdr->objcnt) ||
+        ((uint64_t)e->page * LX_PAGE_SIZE >= lx_object_size(mod, e->obj)))
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    obj = &mod->obj[e->obj];
+    if (e->page >= obj->mapsize)
+    {
+        // page is not in file
+        memset(e->data, 0, LX_PAGE_SIZE);
+        return LX_MOD_OK;
+    }
+    return lx_unpack_page(mod, obj->pagemap - 1 + e->page, e->data);
+}
+
+// unpacked page of the module, NULL on error
+const uint8_t *lx_cache_get(lx_cache_t *cache, const lx_module_t *mod, uint32_t obj, uint32_t page)
+{
+    uint32_t hash = lx_cache_hash(mod, obj, page);
+    lx_cshard_t *sh = LX_CACHE_SHARD(cache, hash);
+    lx_centry_t *e;
+    int rc;
+
+    pthread_mutex_lock(&sh->lock);
+    for (e = sh->hash[hash & sh->mask]; e; e = e->hnext)
+    {
+        if ((e->mod == mod) && (e->obj == obj) && (e->page == page))
+        {
+            break;
+        }
+    }
+    if (e)
+    {
+        // hit, page may be still unpacked by another reader
+        sh->hits++;
+        e->refs++;
+        while (e->rc == LX_CACHE_LOADING)
+        {
+            pthread_cond_wait(&sh->loaded, &sh->lock);
+        }
+        if (e->rc != LX_MOD_OK)
+        {
+            // failed page is out of the cache already, last reader frees it
+            if (!--e->refs)
+            {
+                free(e);
+            }
+            pthread_mutex_unlock(&sh->lock);
+            return NULL;
+        }
+        lx_cache_unlink(sh, e);
+        lx_cache_push(sh, e);
+        pthread_mutex_unlock(&sh->lock);
+        return e->data;
+    }
+    sh->misses++;
+    // reuse least recently used page not in use, if no more pages allowed
+    if (sh->count >= sh->limit)
+    {
+        for (e = sh->tail; e && (e->refs || (e->rc == LX_CACHE_LOADING)); e = e->prev);
+    }
+    if (e)
+    {
+        sh->evictions++;
+        lx_cache_unlink(sh, e);
+        lx_cache_unhash(sh, e);
+    }
+    else
+    {
+        // cache may grow over its limit while all pages are in use
+        e = (lx_centry_t *)malloc(sizeof(lx_centry_t));
+        if (!e)
+        {
+            pthread_mutex_unlock(&sh->lock);
+            return NULL;
+        }
+        sh->count++;
+    }
+    e->mod = mod;
+    e->obj = obj;
+    e->page = page;
+    e->hash = hash;
+    e->refs = 1;
+    e->rc = LX_CACHE_LOADING;
+    e->hnext = sh->hash[hash & sh->mask];
+    sh->hash[hash & sh->mask] = e;
+    lx_cache_push(sh, e);
+    pthread_mutex_unlock(&sh->lock);
+
+    // unpack without the lock
+    rc = lx_cache_load(e);
+
+    pthread_mutex_lock(&sh->lock);
+    e->rc = rc;
+    pthread_cond_broadcast(&sh->loaded);
+    if (rc != LX_MOD_OK)
+    {
+        // failed page is not kept, the next reader unpacks it again.
+        // Readers waiting for it get NULL, the last one frees it
+        lx_cache_unlink(sh, e);
+        lx_cache_unhash(sh, e);
+        sh->count--;
+        if (!--e->refs)
+        {
+            free(e);
+        }
+        pthread_mutex_unlock(&sh->lock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return e->data;
+}
+
+// end of the page use
+void lx_cache_release(lx_cache_t *cache, const uint8_t *data)
+{
+    lx_centry_t *e = (lx_centry_t *)(data - offsetof(lx_centry_t, data));
+    lx_cshard_t *sh = LX_CACHE_SHARD(cache, e->hash);
+
+    pthread_mutex_lock(&sh->lock);
+    if (!--e->refs && (sh->count > sh->limit))
+    {
+        // shard grew over its limit while all pages were in use
+        lx_cache_unlink(sh, e);
+        lx_cache_unhash(sh, e);
+        sh->count--;
+        free(e);
+    }
+    pthread_mutex_unlock(&sh->lock);
+}
+
+// drop all unused pages of the module
+void lx_cache_forget(lx_cache_t *cache, const lx_module_t *mod)
+{
+    lx_cshard_t *sh;
+    lx_centry_t *e, *next;
+    uint32_t i;
+
+    for (i = 0; i < cache->shards; i++)
+    {
+        sh = &cache->shard[i];
+        pthread_mutex_lock(&sh->lock);
+        for (e = sh->head; e; e = next)
+        {
+            next = e->next;
+            if ((e->mod == mod) && !e->refs && (e->rc != LX_CACHE_LOADING))
+            {
+                lx_cache_unlink(sh, e);
+                lx_cache_unhash(sh, e);
+                sh->count--;
+                free(e);
+            }
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+// counters summed over all shards
+void lx_cache_stats(lx_cache_t *cache, lx_cache_stats_t *stats)
+{
+    lx_cshard_t *sh;
+    uint32_t i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < cache->shards; i++)
+    {
+        sh = &cache->shard[i];
+        pthread_mutex_lock(&sh->lock);
+        stats->hits += sh->hits;
+        stats->misses += sh->misses;
+        stats->evictions += sh->evictions;
+        stats->pages += sh->count;
+        pthread_mutex_unlock(&sh->lock);
+    }
+    stats->bytes = (uint64_t)stats->pages * sizeof(lx_centry_t);
+}
+
+#endif // LX_CACHE_IMPLEMENTATION
+
+#endif // __H_LX_CACHE__
@@ -0,0 +1,523 @@
+// SPDX-License-Identifier: MIT
+#ifndef __H_LX_FIXUP__
+#define __H_LX_FIXUP__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "lxmodule.h"
+
+// Fixups of LX pages on the host.
+// Records of a page are decoded once into compact arrays and then applied to
+// any number of unpacked copies of the page, e.g. right after lx_unpack_page
+// while the page is still in cache. Internal 32-bit offset fixups, the most of
+// them in 32-bit code, are kept apart in runs by target object, so applying a
+// run is one add of the object base over an array of offsets. Fixups crossing
+// the page boundary are written only within the page. Requires
+// LX_MODULE_IMPLEMENTATION and LX_UNPACK_IMPLEMENTATION.
+
+// source types, low nibble of the record source byte
+#define LX_FIX_BYTE                    0x00    // low byte of the offset
+#define LX_FIX_SEL16                   0x02    // 16-bit selector
+#define LX_FIX_PTR1616                 0x03    // 16:16 pointer
+#define LX_FIX_OFF16                   0x05    // 16-bit offset
+#define LX_FIX_PTR1632                 0x06    // 16:32 pointer
+#define LX_FIX_OFF32                   0x07    // 32-bit offset
+#define LX_FIX_REL32                   0x08    // 32-bit self-relative offset
+#define LX_FIX_TYPE_MASK               0x0F
+#define LX_FIX_ALIAS                   0x10    // to 16:16 alias of the target
+#define LX_FIX_LIST                    0x20    // source offsets list, record only
+
+// target kinds, low bits of the record flags byte
+#define LX_FIXT_INTERNAL               0       // object and offset
+#define LX_FIXT_ORDINAL                1       // imported by ordinal
+#define LX_FIXT_NAME                   2       // imported by name
+#define LX_FIXT_ENTRY                  3       // internal via entry table
+#define LX_FIXT_MASK                   0x03
+
+// one fixup of the page
+typedef struct lx_fixup_s
+{
+    int16_t     src;             // source offset within the page, may be negative
+    uint8_t     type;            // LX_FIX_xxx source type and alias flag
+    uint8_t     kind;            // LX_FIXT_xxx
+    uint16_t    obj;             // target object (1-based), module ordinal or entry ordinal
+    uint16_t    reserved;
+    uint32_t    value;           // target offset, imported ordinal or name offset
+    int32_t     add;             // additive value, 0 if none
+} lx_fixup_t;
+
+// run of internal 32-bit offset fixups to the same object
+typedef struct lx_fixrun_s
+{
+    uint32_t    obj;             // target object, 1-based
+    uint32_t    first;           // first of them in isrc/ioff
+    uint32_t    count;
+} lx_fixrun_t;
+
+// decoded fixups of one page
+typedef struct lx_fixpage_s
+{
+    lx_fixup_t  *fix;            // all other fixups, sorted by source offset and type
+    uint32_t     count;
+    lx_fixrun_t *run;            // internal 32-bit offset fixups by target object
+    uint32_t     runs;
+    int16_t     *isrc;           // their source offsets, sorted within a run
+    uint32_t    *ioff;           // and target offsets, additive value included
+    uint32_t     icount;
+} lx_fixpage_t;
+
+// where the targets are
+typedef struct lx_fixenv_s
+{
+    const uint32_t  *base;       // address of each object, base[obj - 1]
+    const uint16_t  *sel;        // selector of each object, NULL - all 0
+    // address of imported and entry table targets, NULL - all 0
+    uint32_t       (*resolve)(void *ctx, const lx_fixup_t *fix);
+    void            *ctx;
+} lx_fixenv_t;
+
+// decode fixup records of the page (0-based object page table index),
+// returns LX_MOD_OK or error
+int lx_fixup_decode(const lx_module_t *mod, uint32_t page, lx_fixpage_t *fp);
+// free decoded fixups of the page
+void lx_fixup_free(lx_fixpage_t *fp);
+// apply fixups to the unpacked page loaded at page_va
+void lx_fixup_apply(const lx_fixpage_t *fp, uint8_t *page, uint32_t page_va, const lx_fixenv_t *env);
+// decode fixups of all pages, fp[i] for object page table entry i
+int lx_fixup_module(const lx_module_t *mod, lx_fixpage_t *fp);
+// free fixups of all pages
+void lx_fixup_free_module(const lx_module_t *mod, lx_fixpage_t *fp);
+// unpack all pages of the object (0-based index) into contiguous dst of
+// lx_object_size bytes and fix each page up at once, object is loaded at env->base
+int lx_fixup_object(const lx_module_t *mod, uint32_t obj, const lx_fixpage_t *fp,
+                    uint8_t *dst, uint32_t dst_size, const lx_fixenv_t *env);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef LX_FIXUP_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+// record flags byte
+#define LX_FIXF_ADDITIVE               0x04
+#define LX_FIXF_CHAIN                  0x08    // internal chaining, Warp 4 and later
+#define LX_FIXF_TARGET32               0x10    // 32-bit target offset or ordinal
+#define LX_FIXF_ADDITIVE32             0x20
+#define LX_FIXF_OBJ16                  0x40    // 16-bit object or module number
+#define LX_FIXF_ORD8                   0x80    // 8-bit imported ordinal
+
+// offsets applied per chunk of a run
+#define LX_FIX_CHUNK                   64
+
+#define LX_FIX_IS_FAST(f)              (((f)->kind == LX_FIXT_INTERNAL) && ((f)->type == LX_FIX_OFF32))
+
+// little endian field of size bytes, p is moved past it
+static uint32_t lx_fix_get(const uint8_t **p, uint32_t size)
+{
+    uint32_t v = 0;
+    uint32_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        v |= (uint32_t)(*p)[i] << (i * 8);
+    }
+    *p += size;
+    return v;
+}
+
+// parse records from p to end, fixups go to out if not NULL, all are counted
+static int lx_fix_parse(const uint8_t *p, const uint8_t *end, uint32_t objcnt, lx_fixup_t *out, uint32_t *count)
+{
+    lx_fixup_t f;
+    uint8_t src, flags;
+    uint32_t cnt, need, i;
+
+    *count = 0;
+    while (p < end)
+    {
+        // source byte, flags and source offset or list count
+        if (end - p < ((p[0] & LX_FIX_LIST) ? 3 : 4))
+        {
+            return LX_MOD_ERR_FORMAT;
+        }
+        src = p[0];
+        flags = p[1];
+        p += 2;
+        if (flags & LX_FIXF_CHAIN)
+        {
+            return LX_MOD_ERR_FORMAT;
+        }
+        memset(&f, 0, sizeof(f));
+        f.type = src & (LX_FIX_TYPE_MASK | LX_FIX_ALIAS);
+        f.kind = flags & LX_FIXT_MASK;
+        cnt = 1;
+        if (src & LX_FIX_LIST)
+        {
+            cnt = *p++;
+        }
+        else
+        {
+            f.src = (int16_t)lx_fix_get(&p, 2);
+        }
+        // target fields, additive value and source list
+        need = (flags & LX_FIXF_OBJ16) ? 2 : 1;
+        switch (f.kind)
+        {
+            case LX_FIXT_INTERNAL:
+                need += ((f.type & LX_FIX_TYPE_MASK) == LX_FIX_SEL16) ? 0 : (flags & LX_FIXF_TARGET32) ? 4 : 2;
+                break;
+
+            case LX_FIXT_ORDINAL:
+                need += (flags & LX_FIXF_ORD8) ? 1 : (flags & LX_FIXF_TARGET32) ? 4 : 2;
+                break;
+
+            case LX_FIXT_NAME:
+                need += (flags & LX_FIXF_TARGET32) ? 4 : 2;
+                break;
+        }
+        need += (flags & LX_FIXF_ADDITIVE) ? ((flags & LX_FIXF_ADDITIVE32) ? 4 : 2) : 0;
+        need += (src & LX_FIX_LIST) ? cnt * 2 : 0;
+        if ((uint32_t)(end - p) < need)
+        {
+            return LX_MOD_ERR_FORMAT;
+        }
+        f.obj = (uint16_t)lx_fix_get(&p, (flags & LX_FIXF_OBJ16) ? 2 : 1);
+        switch (f.kind)
+        {
+            case LX_FIXT_INTERNAL:
+                if (!f.obj || (f.obj > objcnt))
+                {
+                    return LX_MOD_ERR_FORMAT;
+                }
+                if ((f.type & LX_FIX_TYPE_MASK) != LX_FIX_SEL16)
+                {
+                    f.value = lx_fix_get(&p, (flags & LX_FIXF_TARGET32) ? 4 : 2);
+                }
+                break;
+
+            case LX_FIXT_ORDINAL:
+                f.value = lx_fix_get(&p, (flags & LX_FIXF_ORD8) ? 1 : (flags & LX_FIXF_TARGET32) ? 4 : 2);
+                break;
+
+            case LX_FIXT_NAME:
+                f.value = lx_fix_get(&p, (flags & LX_FIXF_TARGET32) ? 4 : 2);
+                break;
+        }
+        if (flags & LX_FIXF_ADDITIVE)
+        {
+            f.add = (int32_t)lx_fix_get(&p, (flags & LX_FIXF_ADDITIVE32) ? 4 : 2);
+        }
+        for (i = 0; i < cnt; i++)
+        {
+            if (src & LX_FIX_LIST)
+            {
+                f.src = (int16_t)lx_fix_get(&p, 2);
+            }
+            if (out)
+            {
+                out[*count] = f;
+            }
+            (*count)++;
+        }
+    }
+    return LX_MOD_OK;
+}
+
+static int lx_fix_cmp(const void *a, const void *b)
+{
+    const lx_fixup_t *x = (const lx_fixup_t *)a;
+    const lx_fixup_t *y = (const lx_fixup_t *)b;
+
+    if (x->src != y->src)
+    {
+        return (x->src < y->src) ? -1 : 1;
+    }
+    return (int)x->type - (int)y->type;
+}
+
+// fast fixups by target object, then by source offset
+static int lx_fix_cmp_fast(const void *a, const void *b)
+{
+    const lx_fixup_t *x = (const lx_fixup_t *)a;
+    const lx_fixup_t *y = (const lx_fixup_t *)b;
+
+    if (x->obj != y->obj)
+    {
+        return (x->obj < y->obj) ? -1 : 1;
+    }
+    return (int)x->src - (int)y->src;
+}
+
+// decode fixup records of the page
+int lx_fixup_decode(const lx_module_t *mod, uint32_t page, lx_fixpage_t *fp)
+{
+    const uint8_t *lx = (const uint8_t *)mod->hdr;
+    uint64_t fpt, frec, start, end;
+    lx_fixup_t *all;
+    uint32_t count, fast, i, j;
+    size_t size;
+    uint8_t *mem;
+    int rc;
+
+    memset(fp, 0, sizeof(*fp));
+    if (page >= mod->hdr->mpages)
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    if (!mod->hdr->fpagetab)
+    {
+        // no fixup section at all
+        return LX_MOD_OK;
+    }
+    // fixup page table holds mpages + 1 offsets into the record table
+    fpt = (uint64_t)(lx - mod->image) + mod->hdr->fpagetab;
+    frec = (uint64_t)(lx - mod->image) + mod->hdr->frectab;
+    if (fpt + ((uint64_t)mod->hdr->mpages + 1) * 4 > mod->size)
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    start = frec + (mod->image[fpt + page * 4] | ((uint32_t)mod->image[fpt + page * 4 + 1] << 8) |
+                    ((uint32_t)mod->image[fpt + page * 4 + 2] << 16) | ((uint32_t)mod->image[fpt + page * 4 + 3] << 24));
+    end = frec + (mod->image[fpt + page * 4 + 4] | ((uint32_t)mod->image[fpt + page * 4 + 5] << 8) |
+                  ((uint32_t)mod->image[fpt + page * 4 + 6] << 16) | ((uint32_t)mod->image[fpt + page * 4 + 7] << 24));
+    if ((start > end) || (end > mod->size))
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    rc = lx_fix_parse(mod->image + start, mod->image + end, mod->hdr->objcnt, NULL, &count);
+    if ((rc != LX_MOD_OK) || !count)
+    {
+        return rc;
+    }
+    // one block: all fixups, offsets of the fast ones, runs, their sources
+    size = (size_t)count * (sizeof(lx_fixup_t) + sizeof(uint32_t) + sizeof(lx_fixrun_t) + sizeof(int16_t));
+    mem = (uint8_t *)malloc(size);
+    if (!mem)
+    {
+        return LX_MOD_ERR_MEM;
+    }
+    all = (lx_fixup_t *)mem;
+    fp->ioff = (uint32_t *)(mem + count * sizeof(lx_fixup_t));
+    fp->run = (lx_fixrun_t *)(mem + count * (sizeof(lx_fixup_t) + sizeof(uint32_t)));
+    fp->isrc = (int16_t *)(mem + count * (sizeof(lx_fixup_t) + sizeof(uint32_t) + sizeof(lx_fixrun_t)));
+    lx_fix_parse(mod->image + start, mod->image + end, mod->hdr->objcnt, all, &count);
+    // fast fixups go first
+    for (i = 0, fast = 0; i < count; i++)
+    {
+        if (LX_FIX_IS_FAST(&all[i]))
+        {
+            lx_fixup_t t = all[fast];
+
+            all[fast++] = all[i];
+            all[i] = t;
+        }
+    }
+    qsort(all, fast, sizeof(lx_fixup_t), lx_fix_cmp_fast);
+    qsort(all + fast, count - fast, sizeof(lx_fixup_t), lx_fix_cmp);
+    for (i = 0; i < fast; i++)
+    {
+        if (!i || (all[i].obj != all[i - 1].obj))
+        {
+            fp->run[fp->runs].obj = all[i].obj;
+            fp->run[fp->runs].first = i;
+            fp->run[fp->runs].count = 0;
+            fp->runs++;
+        }
+        fp->run[fp->runs - 1].count++;
+        fp->isrc[i] = all[i].src;
+        fp->ioff[i] = all[i].value + (uint32_t)all[i].add;
+    }
+    fp->icount = fast;
+    // others are moved down over the fast ones
+    for (i = fast, j = 0; i < count; i++, j++)
+    {
+        all[j] = all[i];
+    }
+    fp->fix = all;
+    fp->count = count - fast;
+    return LX_MOD_OK;
+}
+
+// free decoded fixups of the page
+void lx_fixup_free(lx_fixpage_t *fp)
+{
+    free(fp->fix);
+    memset(fp, 0, sizeof(*fp));
+}
+
+// write size bytes of v at src, only bytes within the page
+static void lx_fix_put(uint8_t *page, int32_t src, uint32_t v, uint32_t size)
+{
+    uint32_t i;
+
+    if ((src >= 0) && (src + size <= LX_PAGE_SIZE))
+    {
+        memcpy(page + src, &v, size);
+        return;
+    }
+    for (i = 0; i < size; i++, v >>= 8)
+    {
+        if ((uint32_t)(src + (int32_t)i) < LX_PAGE_SIZE)
+        {
+            page[src + i] = (uint8_t)v;
+        }
+    }
+}
+
+// apply fixups to the unpacked page
+void lx_fixup_apply(const lx_fixpage_t *fp, uint8_t *page, uint32_t page_va, const lx_fixenv_t *env)
+{
+    uint32_t val[LX_FIX_CHUNK];
+    const lx_fixup_t *f;
+    uint32_t i, j, k, n, end, base, target;
+    uint16_t sel;
+    int32_t src;
+
+    for (i = 0; i < fp->runs; i++)
+    {
+        base = env->base[fp->run[i].obj - 1];
+        end = fp->run[i].first + fp->run[i].count;
+        for (j = fp->run[i].first; j < end; j += n)
+        {
+            n = (end - j < LX_FIX_CHUNK) ? end - j : LX_FIX_CHUNK;
+            // plain add over the array, vectorized by the compiler
+            for (k = 0; k < n; k++)
+            {
+                val[k] = fp->ioff[j + k] + base;
+            }
+            for (k = 0; k < n; k++)
+            {
+                if ((uint16_t)fp->isrc[j + k] <= LX_PAGE_SIZE - 4)
+                {
+                    memcpy(page + fp->isrc[j + k], &val[k], 4);
+                }
+                else
+                {
+                    lx_fix_put(page, fp->isrc[j + k], val[k], 4);
+                }
+            }
+        }
+    }
+    for (i = 0; i < fp->count; i++)
+    {
+        f = &fp->fix[i];
+        sel = 0;
+        if (f->kind == LX_FIXT_INTERNAL)
+        {
+            target = env->base[f->obj - 1] + f->value;
+            sel = env->sel ? env->sel[f->obj - 1] : 0;
+        }
+        else
+        {
+            target = env->resolve ? env->resolve(env->ctx, f) : 0;
+        }
+        target += (uint32_t)f->add;
+        src = f->src;
+        switch (f->type & LX_FIX_TYPE_MASK)
+        {
+            case LX_FIX_BYTE:
+                lx_fix_put(page, src, target, 1);
+                break;
+
+            case LX_FIX_SEL16:
+                lx_fix_put(page, src, sel, 2);
+                break;
+
+            case LX_FIX_PTR1616:
+                lx_fix_put(page, src, target, 2);
+                lx_fix_put(page, src + 2, sel, 2);
+                break;
+
+            case LX_FIX_OFF16:
+                lx_fix_put(page, src, target, 2);
+                break;
+
+            case LX_FIX_PTR1632:
+                lx_fix_put(page, src, target, 4);
+                lx_fix_put(page, src + 4, sel, 2);
+                break;
+
+            case LX_FIX_OFF32:
+                lx_fix_put(page, src, target, 4);
+                break;
+
+            case LX_FIX_REL32:
+                lx_fix_put(page, src, target - (page_va + src + 4), 4);
+                break;
+        }
+    }
+}
+
+// decode fixups of all pages
+int lx_fixup_module(const lx_module_t *mod, lx_fixpage_t *fp)
+{
+    uint32_t i;
+    int rc;
+
+    for (i = 0; i < mod->hdr->mpages; i++)
+    {
+        rc = lx_fixup_decode(mod, i, &fp[i]);
+        if (rc != LX_MOD_OK)
+        {
+            while (i > 0)
+            {
+                lx_fixup_free(&fp[--i]);
+            }
+            return rc;
+        }
+    }
+    return LX_MOD_OK;
+}
+
+// free fixups of all pages
+void lx_fixup_free_module(const lx_module_t *mod, lx_fixpage_t *fp)
+{
+    uint32_t i;
+
+    for (i = 0; i < mod->hdr->mpages; i++)
+    {
+        lx_fixup_free(&fp[i]);
+    }
+}
+
+// unpack all pages of the object and fix them up
+int lx_fixup_object(const lx_module_t *mod, uint32_t obj, const lx_fixpage_t *fp,
+                    uint8_t *dst, uint32_t dst_size, const lx_fixenv_t *env)
+{
+    uint32_t size = lx_object_size(mod, obj);
+    uint32_t i, page;
+    int rc;
+
+    if (obj >= mod->hdr->objcnt)
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    if (dst_size < size)
+    {
+        return LX_MOD_ERR_MEM;
+    }
+    for (i = 0; i < mod->obj[obj].mapsize; i++)
+    {
+        page = mod->obj[obj].pagemap - 1 + i;
+        rc = lx_unpack_page(mod, page, dst);
+        if (rc != LX_MOD_OK)
+        {
+            return rc;
+        }
+        // page is still in cache
+        lx_fixup_apply(&fp[page], dst, env->base[obj] + i * LX_PAGE_SIZE, env);
+        dst += LX_PAGE_SIZE;
+    }
+    memset(dst, 0, size - i * LX_PAGE_SIZE);
+    return LX_MOD_OK;
+}
+
+#endif // LX_FIXUP_IMPLEMENTATION
+
+#endif // __H_LX_FIXUP__
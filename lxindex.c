@@ -0,0 +1,781 @@
+// lstat, S_ISDIR and mmap on strict C builds
+#define _XOPEN_SOURCE 700
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LX_UNPACK_IMPLEMENTATION
+#include "lxunpack.h"
+#define LX_MODULE_IMPLEMENTATION
+#include "lxmodule.h"
+
+// Catalog of LX modules found in directory trees, kept in one index file.
+// Index is a header and flat tables of modules, objects, pages and path names,
+// so queries just map it. Rebuild reuses records of files with the same size
+// and mtime as in the previous index, other files are parsed again.
+
+#define LXI_MAGIC                      "LXIX"
+#define LXI_VERSION                    1
+#define LXI_MAX_PATH                   4096
+
+#pragma pack(push,1)
+typedef struct lxi_hdr_s
+{
+    char        magic[4];        // LXI_MAGIC
+    uint32_t    version;         // LXI_VERSION
+    uint32_t    modules;         // number of records in each table
+    uint32_t    objects;
+    uint32_t    pages;
+    uint32_t    names;           // bytes of all path names
+    uint32_t    mod_off;         // file offsets of the tables
+    uint32_t    obj_off;
+    uint32_t    page_off;
+    uint32_t    name_off;
+} lxi_hdr_t;
+
+// one file, LX module or not
+typedef struct lxi_mod_s
+{
+    uint32_t    name;            // offset of NUL-terminated path in names
+    uint64_t    size;            // file size and mtime, to find unchanged files
+    int64_t     mtime;
+    int32_t     rc;              // LX_MOD_xxx of lx_module_open, LX_MOD_ERR_DATA if some pages are bad
+    uint32_t    obj;             // first object record
+    uint32_t    objcnt;
+    uint32_t    page;            // first page record
+    uint32_t    mpages;
+    uint32_t    packed;          // bytes of all pages in file
+    uint32_t    unpacked;        // bytes they unpack to
+    uint32_t    bad;             // pages failed to unpack
+    uint16_t    methods;         // 1 << LX_PAGE_xxx for all page types met
+    uint16_t    reserved;
+} lxi_mod_t;
+
+// object table entry
+typedef struct lxi_obj_s
+{
+    uint32_t    size;
+    uint32_t    base;
+    uint32_t    flags;
+    uint32_t    pagemap;
+    uint32_t    mapsize;
+} lxi_obj_t;
+
+// object page table entry
+typedef struct lxi_page_s
+{
+    uint16_t    flags;           // LX_PAGE_xxx
+    uint16_t    size;            // packed size
+    int16_t     len;             // unpacked size, -1 if page is bad
+} lxi_page_t;
+#pragma pack(pop)
+
+// index being built
+typedef struct lxi_build_s
+{
+    lxi_mod_t  *mod;
+    uint32_t    modules, mod_max;
+    lxi_obj_t  *obj;
+    uint32_t    objects, obj_max;
+    lxi_page_t *page;
+    uint32_t    pages, page_max;
+    char       *name;
+    uint32_t    names, name_max;
+    uint32_t    reused;          // files taken from the old index
+    uint32_t    parsed;          // files parsed again
+} lxi_build_t;
+
+// mapped index file
+typedef struct lxi_map_s
+{
+    const uint8_t    *data;
+    uint32_t          size;
+    const lxi_hdr_t  *hdr;
+    const lxi_mod_t  *mod;
+    const lxi_obj_t  *obj;
+    const lxi_page_t *page;
+    const char       *name;
+    uint32_t         *hash;      // module by path, open addressing, 0 - empty
+    uint32_t          mask;
+} lxi_map_t;
+
+static const char *page_type[] = { "valid", "exepack1", "invalid", "zeroed", "range", "exepack2" };
+
+// room for count more items in array of max items
+static int grow(void **array, uint32_t *max, uint32_t count, size_t item)
+{
+    uint32_t n = *max ? *max : 256;
+    void *p;
+
+    if (count <= *max)
+    {
+        return 0;
+    }
+    while (n < count)
+    {
+        n *= 2;
+    }
+    p = realloc(*array, (size_t)n * item);
+    if (!p)
+    {
+        return -1;
+    }
+    *array = p;
+    *max = n;
+    return 0;
+}
+
+static uint32_t name_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *name; name++)
+    {
+        h = (h ^ (uint8_t)*name) * 16777619u;
+    }
+    return h;
+}
+
+// map whole file read-only
+static const uint8_t *map_file(const char *name, uint32_t *size)
+{
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    data = MAP_FAILED;
+    if (!fstat(fd, &st) && (st.st_size > 0) && (st.st_size <= 0xFFFFFFFFL))
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+    *size = (uint32_t)st.st_size;
+    return (const uint8_t *)data;
+}
+
+static void index_close(lxi_map_t *idx)
+{
+    if (idx->data)
+    {
+        munmap((void *)idx->data, idx->size);
+    }
+    free(idx->hash);
+    memset(idx, 0, sizeof(*idx));
+}
+
+// map index file and check its tables, hash its paths if asked
+static int index_open(lxi_map_t *idx, const char *name, int hashed)
+{
+    const lxi_hdr_t *hdr;
+    uint32_t i, h;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->data = map_file(name, &idx->size);
+    if (!idx->data)
+    {
+        return -1;
+    }
+    hdr = (const lxi_hdr_t *)idx->data;
+    if ( (idx->size < sizeof(lxi_hdr_t)) || memcmp(hdr->magic, LXI_MAGIC, 4) || (hdr->version != LXI_VERSION) ||
+         (hdr->mod_off > idx->size)  || (hdr->modules > (idx->size - hdr->mod_off) / sizeof(lxi_mod_t))  ||
+         (hdr->obj_off > idx->size)  || (hdr->objects > (idx->size - hdr->obj_off) / sizeof(lxi_obj_t))  ||
+         (hdr->page_off > idx->size) || (hdr->pages > (idx->size - hdr->page_off) / sizeof(lxi_page_t)) ||
+         (hdr->name_off > idx->size) || (hdr->names > idx->size - hdr->name_off) ||
+         !hdr->names || idx->data[hdr->name_off + hdr->names - 1]
+       )
+    {
+        index_close(idx);
+        return -1;
+    }
+    idx->hdr = hdr;
+    idx->mod = (const lxi_mod_t *)(idx->data + hdr->mod_off);
+    idx->obj = (const lxi_obj_t *)(idx->data + hdr->obj_off);
+    idx->page = (const lxi_page_t *)(idx->data + hdr->page_off);
+    idx->name = (const char *)(idx->data + hdr->name_off);
+    for (i = 0; i < hdr->modules; i++)
+    {
+        if ( (idx->mod[i].name >= hdr->names) ||
+             (idx->mod[i].obj > hdr->objects) || (idx->mod[i].objcnt > hdr->objects - idx->mod[i].obj) ||
+             (idx->mod[i].page > hdr->pages)  || (idx->mod[i].mpages > hdr->pages - idx->mod[i].page)
+           )
+        {
+            index_close(idx);
+            return -1;
+        }
+    }
+    if (!hashed)
+    {
+        return 0;
+    }
+    for (h = 16; h < hdr->modules * 2; h <<= 1);
+    idx->mask = h - 1;
+    idx->hash = (uint32_t *)calloc(h, sizeof(uint32_t));
+    if (!idx->hash)
+    {
+        index_close(idx);
+        return -1;
+    }
+    for (i = 0; i < hdr->modules; i++)
+    {
+        for (h = name_hash(idx->name + idx->mod[i].name) & idx->mask; idx->hash[h]; h = (h + 1) & idx->mask);
+        idx->hash[h] = i + 1;
+    }
+    return 0;
+}
+
+// module of the old index with given path, NULL if none
+static const lxi_mod_t *index_find(const lxi_map_t *idx, const char *path)
+{
+    uint32_t h;
+
+    if (!idx->hash)
+    {
+        return NULL;
+    }
+    for (h = name_hash(path) & idx->mask; idx->hash[h]; h = (h + 1) & idx->mask)
+    {
+        if (!strcmp(idx->name + idx->mod[idx->hash[h] - 1].name, path))
+        {
+            return &idx->mod[idx->hash[h] - 1];
+        }
+    }
+    return NULL;
+}
+
+// new module record with its path
+static lxi_mod_t *add_module(lxi_build_t *b, const char *path, const struct stat *st)
+{
+    uint32_t len = (uint32_t)strlen(path) + 1;
+    lxi_mod_t *m;
+
+    if ( grow((void **)&b->mod, &b->mod_max, b->modules + 1, sizeof(lxi_mod_t)) ||
+         grow((void **)&b->name, &b->name_max, b->names + len, 1)
+       )
+    {
+        return NULL;
+    }
+    m = &b->mod[b->modules++];
+    memset(m, 0, sizeof(*m));
+    m->name = b->names;
+    memcpy(b->name + b->names, path, len);
+    b->names += len;
+    m->size = st->st_size;
+    m->mtime = st->st_mtime;
+    m->obj = b->objects;
+    m->page = b->pages;
+    return m;
+}
+
+// copy records of unchanged file from the old index
+static int reuse_module(lxi_build_t *b, lxi_mod_t *m, const lxi_map_t *old, const lxi_mod_t *om)
+{
+    if ( grow((void **)&b->obj, &b->obj_max, b->objects + om->objcnt, sizeof(lxi_obj_t)) ||
+         grow((void **)&b->page, &b->page_max, b->pages + om->mpages, sizeof(lxi_page_t))
+       )
+    {
+        return -1;
+    }
+    memcpy(&b->obj[b->objects], &old->obj[om->obj], om->objcnt * sizeof(lxi_obj_t));
+    memcpy(&b->page[b->pages], &old->page[om->page], om->mpages * sizeof(lxi_page_t));
+    b->objects += om->objcnt;
+    b->pages += om->mpages;
+    m->rc = om->rc;
+    m->objcnt = om->objcnt;
+    m->mpages = om->mpages;
+    m->packed = om->packed;
+    m->unpacked = om->unpacked;
+    m->bad = om->bad;
+    m->methods = om->methods;
+    b->reused++;
+    return 0;
+}
+
+// parse the file, pages are sized by the EXEPACK decoders without unpacking
+static int parse_module(lxi_build_t *b, lxi_mod_t *m, const char *path)
+{
+    lx_module_t mod;
+    const lx_map_t *map;
+    const uint8_t *image, *src;
+    lxi_page_t *p;
+    uint32_t size = 0, i;
+
+    b->parsed++;
+    image = map_file(path, &size);
+    if (!image)
+    {
+        m->rc = LX_MOD_ERR_FORMAT;
+        return 0;
+    }
+    m->rc = lx_module_open(&mod, image, size);
+    if (m->rc != LX_MOD_OK)
+    {
+        munmap((void *)image, size);
+        return 0;
+    }
+    if ( grow((void **)&b->obj, &b->obj_max, b->objects + mod.hdr->objcnt, sizeof(lxi_obj_t)) ||
+         grow((void **)&b->page, &b->page_max, b->pages + mod.hdr->mpages, sizeof(lxi_page_t))
+       )
+    {
+        munmap((void *)image, size);
+        return -1;
+    }
+    for (i = 0; i < mod.hdr->objcnt; i++)
+    {
+        b->obj[b->objects].size = mod.obj[i].size;
+        b->obj[b->objects].base = mod.obj[i].base;
+        b->obj[b->objects].flags = mod.obj[i].flags;
+        b->obj[b->objects].pagemap = mod.obj[i].pagemap;
+        b->obj[b->objects].mapsize = mod.obj[i].mapsize;
+        b->objects++;
+    }
+    m->objcnt = mod.hdr->objcnt;
+    for (i = 0; i < mod.hdr->mpages; i++)
+    {
+        map = &mod.map[i];
+        p = &b->page[b->pages++];
+        p->flags = map->flags;
+        p->size = map->size;
+        p->len = -1;
+        src = lx_page_data(&mod, i);
+        switch (map->flags)
+        {
+            case LX_PAGE_INVALID:
+            case LX_PAGE_ZEROED:
+                p->len = 0;
+                break;
+
+            case LX_PAGE_VALID:
+                if (src && (map->size <= LX_PAGE_SIZE))
+                {
+                    p->len = map->size;
+                }
+                break;
+
+            case LX_PAGE_ITERDATA:
+                if (src && (map->size <= 0x7FFF))
+                {
+                    p->len = lx_unpack1_size(src, (int16_t)map->size);
+                }
+                break;
+
+            case LX_PAGE_ITERDATA2:
+                if (src && (map->size <= 0x7FFF))
+                {
+                    p->len = lx_unpack2_size(src, (int16_t)map->size);
+                }
+                break;
+        }
+        if (map->flags < 16)
+        {
+            m->methods |= 1 << map->flags;
+        }
+        if (p->len < 0)
+        {
+            m->bad++;
+        }
+        else
+        {
+            m->unpacked += p->len;
+        }
+        m->packed += (map->flags == LX_PAGE_VALID) || (map->flags == LX_PAGE_ITERDATA) ||
+                     (map->flags == LX_PAGE_ITERDATA2) ? map->size : 0;
+    }
+    m->mpages = mod.hdr->mpages;
+    if (m->bad)
+    {
+        m->rc = LX_MOD_ERR_DATA;
+    }
+    munmap((void *)image, size);
+    return 0;
+}
+
+// add all regular files of the directory tree, symlinks are not followed
+static int walk(lxi_build_t *b, const lxi_map_t *old, char *path, uint32_t len)
+{
+    const lxi_mod_t *om;
+    struct dirent *de;
+    struct stat st;
+    lxi_mod_t *m;
+    uint32_t n;
+    DIR *dir;
+    int rc = 0;
+
+    dir = opendir(path);
+    if (!dir)
+    {
+        fprintf(stderr, "Error to open directory %s\n", path);
+        return 0;
+    }
+    while (!rc && ((de = readdir(dir)) != NULL))
+    {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+        {
+            continue;
+        }
+        n = (uint32_t)strlen(de->d_name);
+        if (len + n + 2 > LXI_MAX_PATH)
+        {
+            continue;
+        }
+        path[len] = '/';
+        memcpy(path + len + 1, de->d_name, n + 1);
+        if (lstat(path, &st))
+        {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            rc = walk(b, old, path, len + 1 + n);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            om = index_find(old, path);
+            m = add_module(b, path, &st);
+            if (!m)
+            {
+                rc = -1;
+            }
+            else if (om && (om->size == (uint64_t)st.st_size) && (om->mtime == (int64_t)st.st_mtime))
+            {
+                rc = reuse_module(b, m, old, om);
+            }
+            else
+            {
+                rc = parse_module(b, m, path);
+            }
+        }
+        path[len] = 0;
+    }
+    closedir(dir);
+    return rc;
+}
+
+// write the index to a temporary file, then put it in place of the old one
+static int index_write(const lxi_build_t *b, const char *name)
+{
+    char tmp[LXI_MAX_PATH + 8];
+    lxi_hdr_t hdr;
+    FILE *f;
+    int rc = -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LXI_MAGIC, 4);
+    hdr.version = LXI_VERSION;
+    hdr.modules = b->modules;
+    hdr.objects = b->objects;
+    hdr.pages = b->pages;
+    hdr.names = b->names;
+    hdr.mod_off = sizeof(hdr);
+    hdr.obj_off = hdr.mod_off + b->modules * sizeof(lxi_mod_t);
+    hdr.page_off = hdr.obj_off + b->objects * sizeof(lxi_obj_t);
+    hdr.name_off = hdr.page_off + b->pages * sizeof(lxi_page_t);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    f = fopen(tmp, "wb");
+    if (!f)
+    {
+        return -1;
+    }
+    if ( (fwrite(&hdr, sizeof(hdr), 1, f) == 1) &&
+         (fwrite(b->mod, sizeof(lxi_mod_t), b->modules, f) == b->modules) &&
+         (fwrite(b->obj, sizeof(lxi_obj_t), b->objects, f) == b->objects) &&
+         (fwrite(b->page, sizeof(lxi_page_t), b->pages, f) == b->pages) &&
+         (fwrite(b->name, 1, b->names, f) == b->names)
+       )
+    {
+        rc = 0;
+    }
+    if (fclose(f) || rc || rename(tmp, name))
+    {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static int do_build(const char *name, int count, char *dirs[])
+{
+    char path[LXI_MAX_PATH];
+    lxi_build_t b;
+    lxi_map_t old;
+    uint32_t len;
+    clock_t t0 = clock();
+    int i, rc = 0;
+
+    memset(&b, 0, sizeof(b));
+    // missing or broken old index means all files are parsed
+    index_open(&old, name, 1);
+    // names pool starts with an empty name, so it is never empty
+    if (grow((void **)&b.name, &b.name_max, 1, 1))
+    {
+        return 2;
+    }
+    b.name[b.names++] = 0;
+    for (i = 0; !rc && (i < count); i++)
+    {
+        len = (uint32_t)strlen(dirs[i]);
+        while ((len > 1) && (dirs[i][len - 1] == '/'))
+        {
+            len--;
+        }
+        if (len >= LXI_MAX_PATH)
+        {
+            continue;
+        }
+        memcpy(path, dirs[i], len);
+        path[len] = 0;
+        rc = walk(&b, &old, path, len);
+    }
+    if (!rc)
+    {
+        rc = index_write(&b, name);
+    }
+    index_close(&old);
+    if (rc)
+    {
+        fprintf(stderr, "Error to write index %s\n", name);
+    }
+    else
+    {
+        fprintf(stdout, "%u files (%u parsed, %u unchanged), %u objects, %u pages in %.3f s\n", b.modules,
+                b.parsed, b.reused, b.objects, b.pages, (double)(clock() - t0) / CLOCKS_PER_SEC);
+    }
+    free(b.mod);
+    free(b.obj);
+    free(b.page);
+    free(b.name);
+    return rc ? 3 : 0;
+}
+
+// query filters, unset ones are -1 or NULL
+typedef struct lxi_query_s
+{
+    const char *name;            // path contains
+    int32_t     objects;         // exact number of objects
+    int32_t     min_pages;       // range of page count
+    int32_t     max_pages;
+    int32_t     method;          // has pages of type LX_PAGE_xxx
+    int32_t     obj_flags;       // has an object with all these flags
+    int32_t     bad;             // LX module has pages failed to unpack
+} lxi_query_t;
+
+static int match(const lxi_map_t *idx, const lxi_mod_t *m, const lxi_query_t *q)
+{
+    uint32_t i;
+
+    if (q->bad >= 0)
+    {
+        // bad means: LX module with pages failed to unpack
+        if (q->bad != (m->rc == LX_MOD_ERR_DATA))
+        {
+            return 0;
+        }
+    }
+    else if (m->rc == LX_MOD_ERR_FORMAT)
+    {
+        // files other than LX modules are never listed
+        return 0;
+    }
+    if ((q->objects >= 0) && (m->objcnt != (uint32_t)q->objects))
+    {
+        return 0;
+    }
+    if ( ((q->min_pages >= 0) && (m->mpages < (uint32_t)q->min_pages)) ||
+         ((q->max_pages >= 0) && (m->mpages > (uint32_t)q->max_pages))
+       )
+    {
+        return 0;
+    }
+    if ((q->method >= 0) && !(m->methods & (1 << q->method)))
+    {
+        return 0;
+    }
+    if (q->obj_flags >= 0)
+    {
+        for (i = 0; i < m->objcnt; i++)
+        {
+            if ((idx->obj[m->obj + i].flags & (uint32_t)q->obj_flags) == (uint32_t)q->obj_flags)
+            {
+                break;
+            }
+        }
+        if (i == m->objcnt)
+        {
+            return 0;
+        }
+    }
+    if (q->name && !strstr(idx->name + m->name, q->name))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+static void print_module(const lxi_map_t *idx, const lxi_mod_t *m)
+{
+    uint32_t i;
+
+    fprintf(stdout, "%s: %u objects, %u pages, %u -> %u bytes", idx->name + m->name,
+            m->objcnt, m->mpages, m->packed, m->unpacked);
+    for (i = 0; i < sizeof(page_type) / sizeof(page_type[0]); i++)
+    {
+        if (m->methods & (1 << i))
+        {
+            fprintf(stdout, " %s", page_type[i]);
+        }
+    }
+    if (m->bad)
+    {
+        fprintf(stdout, ", %u bad pages", m->bad);
+    }
+    fprintf(stdout, "\n");
+}
+
+static int do_find(const char *name, int argc, char *argv[])
+{
+    lxi_query_t q;
+    lxi_map_t idx;
+    uint32_t i, found = 0;
+    clock_t t0 = clock();
+    int a;
+
+    q.name = NULL;
+    q.objects = q.min_pages = q.max_pages = q.method = q.obj_flags = q.bad = -1;
+    for (a = 0; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-bad"))
+        {
+            q.bad = 1;
+            continue;
+        }
+        if (a + 1 >= argc)
+        {
+            fprintf(stderr, "Value of %s is missing\n", argv[a]);
+            return 1;
+        }
+        if (!strcmp(argv[a], "-name"))
+        {
+            q.name = argv[++a];
+        }
+        else if (!strcmp(argv[a], "-objects"))
+        {
+            q.objects = atoi(argv[++a]);
+        }
+        else if (!strcmp(argv[a], "-pages"))
+        {
+            // N or N-M
+            a++;
+            q.min_pages = atoi(argv[a]);
+            q.max_pages = strchr(argv[a], '-') ? atoi(strchr(argv[a], '-') + 1) : q.min_pages;
+        }
+        else if (!strcmp(argv[a], "-method"))
+        {
+            a++;
+            q.method = !strcmp(argv[a], "1") ? LX_PAGE_ITERDATA : !strcmp(argv[a], "2") ? LX_PAGE_ITERDATA2 : LX_PAGE_VALID;
+        }
+        else if (!strcmp(argv[a], "-flags"))
+        {
+            q.obj_flags = (int32_t)strtoul(argv[++a], NULL, 16);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown filter %s\n", argv[a]);
+            return 1;
+        }
+    }
+    if (index_open(&idx, name, 0))
+    {
+        fprintf(stderr, "Error to open index %s\n", name);
+        return 2;
+    }
+    for (i = 0; i < idx.hdr->modules; i++)
+    {
+        if (match(&idx, &idx.mod[i], &q))
+        {
+            print_module(&idx, &idx.mod[i]);
+            found++;
+        }
+    }
+    fprintf(stdout, "%u of %u files matched in %.3f ms\n", found, idx.hdr->modules,
+            (double)(clock() - t0) * 1000 / CLOCKS_PER_SEC);
+    index_close(&idx);
+    return 0;
+}
+
+// objects and pages of one module
+static int do_show(const char *name, const char *path)
+{
+    const lxi_mod_t *m;
+    const lxi_obj_t *o;
+    const lxi_page_t *p;
+    lxi_map_t idx;
+    uint32_t i, j;
+
+    if (index_open(&idx, name, 1))
+    {
+        fprintf(stderr, "Error to open index %s\n", name);
+        return 2;
+    }
+    m = index_find(&idx, path);
+    if (!m || (m->rc == LX_MOD_ERR_FORMAT))
+    {
+        fprintf(stderr, "No LX module %s in index\n", path);
+        index_close(&idx);
+        return 2;
+    }
+    print_module(&idx, m);
+    for (i = 0; i < m->objcnt; i++)
+    {
+        o = &idx.obj[m->obj + i];
+        fprintf(stdout, "object %u: base %08X size %08X flags %08X pages %u\n", i + 1, o->base, o->size, o->flags, o->mapsize);
+        for (j = 0; j < o->mapsize; j++)
+        {
+            if (o->pagemap - 1 + j >= m->mpages)
+            {
+                break;
+            }
+            p = &idx.page[m->page + o->pagemap - 1 + j];
+            fprintf(stdout, "  page %u: %-8s %5u -> %d\n", o->pagemap + j,
+                    (p->flags < sizeof(page_type) / sizeof(page_type[0])) ? page_type[p->flags] : "unknown", p->size, p->len);
+        }
+    }
+    index_close(&idx);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc >= 4) && !strcmp(argv[1], "build"))
+    {
+        return do_build(argv[2], argc - 3, &argv[3]);
+    }
+    if ((argc >= 3) && !strcmp(argv[1], "find"))
+    {
+        return do_find(argv[2], argc - 3, &argv[3]);
+    }
+    if ((argc == 4) && !strcmp(argv[1], "show"))
+    {
+        return do_show(argv[2], argv[3]);
+    }
+    fprintf(stdout, "USAGE: %s build <index file> <directory> ...\n"
+                    "       %s find <index file> [-name <text>] [-objects <count>] [-pages <min>[-<max>]]\n"
+                    "                            [-method <0, 1 or 2>] [-flags <hex object flags>] [-bad]\n"
+                    "       %s show <index file> <module path>\n", argv[0], argv[0], argv[0]);
+    return 1;
+}
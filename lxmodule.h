@@ -0,0 +1,428 @@
+// SPDX-License-Identifier: MIT
+#ifndef __H_LX_MODULE__
+#define __H_LX_MODULE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "lxunpack.h"
+
+// Whole-module access to OS/2 LX files, kept in memory as a single image.
+// Page decoding is done by lxunpack.h, so LX_UNPACK_IMPLEMENTATION must be
+// defined in the same or some other translation unit as LX_MODULE_IMPLEMENTATION
+
+// offset of the new header pointer within the DOS stub
+#define LX_MZ_LFANEW                   0x3C
+
+// object page table flags
+#define LX_PAGE_VALID                  0x0000  // legal physical page
+#define LX_PAGE_ITERDATA               0x0001  // iterated data page, EXEPACK:1
+#define LX_PAGE_INVALID                0x0002  // invalid page, reads as zeroes
+#define LX_PAGE_ZEROED                 0x0003  // zero filled page
+#define LX_PAGE_RANGE                  0x0004  // range of pages, not used by LX
+#define LX_PAGE_ITERDATA2              0x0005  // compressed page, EXEPACK:2
+
+// largest object, whole pages of it must fit into 32 bits
+#define LX_OBJ_MAX_SIZE                0xFFFFF000UL
+
+// return codes of the module functions
+#define LX_MOD_OK                      0
+#define LX_MOD_ERR_FORMAT              (-1)    // not an LX file or broken tables
+#define LX_MOD_ERR_DATA                (-2)    // page data is out of file or corrupted
+#define LX_MOD_ERR_MEM                 (-3)    // output buffer is too small
+
+// LX header, all table offsets are relative to it, unless noted
+#pragma pack(push,1)
+typedef struct lx_hdr_s
+{
+    uint8_t     magic[2];        // "LX"
+    uint8_t     border;          // byte order, 0 - little endian
+    uint8_t     worder;          // word order, 0 - little endian
+    uint32_t    level;           // format level, 0
+    uint16_t    cpu;             // CPU type
+    uint16_t    os;              // OS type, 1 - OS/2
+    uint32_t    ver;             // module version
+    uint32_t    mflags;          // module flags
+    uint32_t    mpages;          // number of pages in the module
+    uint32_t    startobj;        // object of the entry point
+    uint32_t    eip;             // entry point offset
+    uint32_t    stackobj;        // object of the stack
+    uint32_t    esp;             // initial stack pointer
+    uint32_t    pagesize;        // page size, always 4096
+    uint32_t    pageshift;       // shift of the page data offsets
+    uint32_t    fixupsize;       // size of the fixup section
+    uint32_t    fixupsum;        // fixup section checksum
+    uint32_t    ldrsize;         // size of the loader section
+    uint32_t    ldrsum;          // loader section checksum
+    uint32_t    objtab;          // object table offset
+    uint32_t    objcnt;          // number of objects
+    uint32_t    objmap;          // object page table offset
+    uint32_t    itermap;         // iterated pages offset, file relative
+    uint32_t    rsrctab;         // resource table offset
+    uint32_t    rsrccnt;         // number of resources
+    uint32_t    restab;          // resident name table offset
+    uint32_t    enttab;          // entry table offset
+    uint32_t    dirtab;          // module directives table offset
+    uint32_t    dircnt;          // number of module directives
+    uint32_t    fpagetab;        // fixup page table offset
+    uint32_t    frectab;         // fixup record table offset
+    uint32_t    impmod;          // import module name table offset
+    uint32_t    impmodcnt;       // number of import modules
+    uint32_t    impproc;         // import procedure name table offset
+    uint32_t    pagesum;         // per-page checksum table offset
+    uint32_t    datapage;        // data pages offset, file relative
+    uint32_t    preload;         // number of preload pages
+    uint32_t    nrestab;         // non-resident name table offset, file relative
+    uint32_t    cbnrestab;       // non-resident name table size
+    uint32_t    nressum;         // non-resident name table checksum
+    uint32_t    autodata;        // object of the automatic data
+    uint32_t    debuginfo;       // debug info offset, file relative
+    uint32_t    debuglen;        // debug info size
+    uint32_t    instpreload;     // number of instance pages in preload section
+    uint32_t    instdemand;      // number of instance pages in demand section
+    uint32_t    heapsize;        // heap size for 16-bit apps
+    uint32_t    stacksize;       // stack size
+    uint8_t     res[20];         // reserved
+} lx_hdr_t;
+#pragma pack(pop)
+
+// object table entry
+#pragma pack(push,1)
+typedef struct lx_obj_s
+{
+    uint32_t    size;            // virtual size of the object
+    uint32_t    base;            // relocation base address
+    uint32_t    flags;           // object flags
+    uint32_t    pagemap;         // first object page table entry, 1-based
+    uint32_t    mapsize;         // number of object page table entries
+    uint32_t    reserved;
+} lx_obj_t;
+#pragma pack(pop)
+
+// object page table entry
+#pragma pack(push,1)
+typedef struct lx_map_s
+{
+    uint32_t    offset;          // page data offset from datapage, shifted by pageshift
+    uint16_t    size;            // size of the page data in file
+    uint16_t    flags;           // LX_PAGE_xxx
+} lx_map_t;
+#pragma pack(pop)
+
+// LX module within the memory image of the file
+typedef struct lx_module_s
+{
+    const uint8_t  *image;       // whole file image
+    uint32_t        size;        // image size in bytes
+    const lx_hdr_t *hdr;         // LX header
+    const lx_obj_t *obj;         // object table, hdr->objcnt entries
+    const lx_map_t *map;         // object page table, hdr->mpages entries
+    int             checked;     // EXEPACK:2 pages passed lx_module_check
+} lx_module_t;
+
+// parse headers of the LX file image and validate its tables
+int lx_module_open(lx_module_t *mod, const uint8_t *image, uint32_t size);
+// check all EXEPACK:2 pages once, so they are unpacked without bounds checks
+// later. Returns LX_MOD_OK or error of the first bad page
+int lx_module_check(lx_module_t *mod);
+// packed data of the page (0-based object page table index), NULL if out of image
+const uint8_t *lx_page_data(const lx_module_t *mod, uint32_t page);
+// unpack one page (0-based object page table index) into LX_PAGE_SIZE bytes of dst
+int lx_unpack_page(const lx_module_t *mod, uint32_t page, uint8_t *dst);
+// same into dst_size bytes of dst, e.g. the tail of an object buffer. Page is
+// unpacked in place, up to LX_PAGE_SIZE bytes, page data past dst_size is dropped
+int lx_unpack_page_span(const lx_module_t *mod, uint32_t page, uint8_t *dst, uint32_t dst_size);
+// same from packed data src of the page described by map, e.g. read from the
+// file apart from the image. src is map->size bytes, NULL if out of file, it is
+// always unpacked with bounds checks
+int lx_unpack_data(const lx_map_t *map, const uint8_t *src, uint8_t *dst, uint32_t dst_size);
+// size of the buffer for the object (0-based index) image, in whole pages
+uint32_t lx_object_size(const lx_module_t *mod, uint32_t obj);
+// unpack all pages of the object (0-based index) into contiguous dst.
+// dst_size may be less than lx_object_size, down to the object virtual size,
+// then the image is cut at dst_size
+int lx_unpack_object(const lx_module_t *mod, uint32_t obj, uint8_t *dst, uint32_t dst_size);
+// unpack all objects, objects[i] must hold lx_object_size(mod, i) bytes
+int lx_unpack_module(const lx_module_t *mod, uint8_t *const *objects);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef LX_MODULE_IMPLEMENTATION
+
+#include <string.h>
+
+// parse headers of the LX file image and validate its tables
+int lx_module_open(lx_module_t *mod, const uint8_t *image, uint32_t size)
+{
+    const lx_hdr_t *hdr;
+    uint32_t lx_off = 0;
+    uint32_t i;
+
+    // skip the DOS stub, if any
+    if ((size >= LX_MZ_LFANEW + 4) && (image[0] == 'M') && (image[1] == 'Z'))
+    {
+        lx_off = image[LX_MZ_LFANEW] | ((uint32_t)image[LX_MZ_LFANEW + 1] << 8) |
+                 ((uint32_t)image[LX_MZ_LFANEW + 2] << 16) | ((uint32_t)image[LX_MZ_LFANEW + 3] << 24);
+    }
+    if ((lx_off >= size) || (size - lx_off < sizeof(lx_hdr_t)))
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    hdr = (const lx_hdr_t *)(image + lx_off);
+    if ( (hdr->magic[0] != 'L') || (hdr->magic[1] != 'X') ||
+         (hdr->border != 0)     || (hdr->worder != 0)     ||
+         (hdr->pagesize != LX_PAGE_SIZE) || (hdr->pageshift > 31)
+       )
+    {
+        // wrong LX header, or big endian
+        return LX_MOD_ERR_FORMAT;
+    }
+    // both tables must fit into the image
+    if ( (hdr->objtab > size - lx_off) ||
+         (hdr->objcnt > (size - lx_off - hdr->objtab) / sizeof(lx_obj_t)) ||
+         (hdr->objmap > size - lx_off) ||
+         (hdr->mpages > (size - lx_off - hdr->objmap) / sizeof(lx_map_t))
+       )
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    mod->image = image;
+    mod->size = size;
+    mod->hdr = hdr;
+    mod->obj = (const lx_obj_t *)(image + lx_off + hdr->objtab);
+    mod->map = (const lx_map_t *)(image + lx_off + hdr->objmap);
+    mod->checked = 0;
+    // objects must fit into 32-bit address space and refer to existing pages only
+    for (i = 0; i < hdr->objcnt; i++)
+    {
+        if ( (mod->obj[i].size > LX_OBJ_MAX_SIZE) ||
+             (mod->obj[i].mapsize > LX_OBJ_MAX_SIZE / LX_PAGE_SIZE) )
+        {
+            return LX_MOD_ERR_FORMAT;
+        }
+        if ( mod->obj[i].mapsize &&
+             ( (mod->obj[i].pagemap == 0) ||
+               (mod->obj[i].pagemap > hdr->mpages) ||
+               (mod->obj[i].mapsize > hdr->mpages - mod->obj[i].pagemap + 1)
+             )
+           )
+        {
+            return LX_MOD_ERR_FORMAT;
+        }
+    }
+    return LX_MOD_OK;
+}
+
+// check all EXEPACK:2 pages once
+int lx_module_check(lx_module_t *mod)
+{
+    const lx_map_t *map;
+    const uint8_t *src;
+    uint32_t i;
+
+    for (i = 0; i < mod->hdr->mpages; i++)
+    {
+        map = &mod->map[i];
+        if (map->flags != LX_PAGE_ITERDATA2)
+        {
+            continue;
+        }
+        src = lx_page_data(mod, i);
+        if (!src || (map->size > 0x7FFF) || (lx_unpack2_size(src, (int16_t)map->size) < 0))
+        {
+            return LX_MOD_ERR_DATA;
+        }
+    }
+    mod->checked = 1;
+    return LX_MOD_OK;
+}
+
+// packed data of the page (0-based object page table index), NULL if out of image
+const uint8_t *lx_page_data(const lx_module_t *mod, uint32_t page)
+{
+    const lx_map_t *map = &mod->map[page];
+    uint64_t offset;
+
+    offset = (uint64_t)mod->hdr->datapage + ((uint64_t)map->offset << mod->hdr->pageshift);
+    if ((offset > mod->size) || (map->size > mod->size - offset))
+    {
+        return NULL;
+    }
+    return mod->image + offset;
+}
+
+// unpack one page (0-based object page table index) into LX_PAGE_SIZE bytes of dst
+int lx_unpack_page(const lx_module_t *mod, uint32_t page, uint8_t *dst)
+{
+    return lx_unpack_page_span(mod, page, dst, LX_PAGE_SIZE);
+}
+
+// unpack packed data of the page into dst_size bytes of dst, EXEPACK:2 data
+// without bounds checks if checked, i.e. it passed lx_module_check
+static int lx_unpack_src(const lx_map_t *map, const uint8_t *src, uint8_t *dst, uint32_t dst_size, int checked)
+{
+    const int16_t room = (dst_size < LX_PAGE_SIZE) ? (int16_t)dst_size : LX_PAGE_SIZE;
+    uint8_t buf[LX_PAGE_SIZE];
+    int16_t len;
+
+    switch (map->flags)
+    {
+        case LX_PAGE_INVALID:
+        case LX_PAGE_ZEROED:
+            len = 0;
+            break;
+
+        case LX_PAGE_VALID:
+        case LX_PAGE_ITERDATA:
+        case LX_PAGE_ITERDATA2:
+            if (!src || (map->size > 0x7FFF))
+            {
+                return LX_MOD_ERR_DATA;
+            }
+            if ((map->flags == LX_PAGE_ITERDATA2) && checked && (room == LX_PAGE_SIZE))
+            {
+                len = lx_unpack2_unchecked(dst, src, (int16_t)map->size);
+            }
+            else if (map->flags == LX_PAGE_ITERDATA2)
+            {
+                len = lx_unpack2_span(dst, room, src, (int16_t)map->size);
+            }
+            else if (map->flags == LX_PAGE_ITERDATA)
+            {
+                len = lx_unpack1_span(dst, room, src, (int16_t)map->size);
+            }
+            else
+            {
+                // plain page, may be shorter than the page size
+                if (map->size > LX_PAGE_SIZE)
+                {
+                    return LX_MOD_ERR_DATA;
+                }
+                len = ((int16_t)map->size < room) ? (int16_t)map->size : room;
+                memcpy(dst, src, len);
+            }
+            if ((len < 0) && (room < LX_PAGE_SIZE))
+            {
+                // page data goes past dst_size, unpack it aside and cut
+                len = (map->flags == LX_PAGE_ITERDATA2) ? lx_unpack2(buf, (uint8_t *)src, (int16_t)map->size) :
+                                                          lx_unpack1(buf, (uint8_t *)src, (int16_t)map->size);
+                if (len > room)
+                {
+                    len = room;
+                }
+                if (len > 0)
+                {
+                    memcpy(dst, buf, len);
+                }
+            }
+            if (len < 0)
+            {
+                return LX_MOD_ERR_DATA;
+            }
+            break;
+
+        default:
+            // range pages and unknown types
+            return LX_MOD_ERR_FORMAT;
+    }
+    // rest of the page reads as zeroes
+    memset(dst + len, 0, room - len);
+    return LX_MOD_OK;
+}
+
+// unpack one page into dst_size bytes of dst
+int lx_unpack_page_span(const lx_module_t *mod, uint32_t page, uint8_t *dst, uint32_t dst_size)
+{
+    if (page >= mod->hdr->mpages)
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    // only pages of the image were checked by lx_module_check
+    return lx_unpack_src(&mod->map[page], lx_page_data(mod, page), dst, dst_size, mod->checked);
+}
+
+// unpack packed data of the page into dst_size bytes of dst
+int lx_unpack_data(const lx_map_t *map, const uint8_t *src, uint8_t *dst, uint32_t dst_size)
+{
+    return lx_unpack_src(map, src, dst, dst_size, 0);
+}
+
+// size of the buffer for the object (0-based index) image, in whole pages
+uint32_t lx_object_size(const lx_module_t *mod, uint32_t obj)
+{
+    uint32_t pages;
+
+    if (obj >= mod->hdr->objcnt)
+    {
+        return 0;
+    }
+    // virtual size may be smaller than the mapped pages or larger (BSS)
+    pages = (uint32_t)(((uint64_t)mod->obj[obj].size + LX_PAGE_SIZE - 1) / LX_PAGE_SIZE);
+    if (pages < mod->obj[obj].mapsize)
+    {
+        pages = mod->obj[obj].mapsize;
+    }
+    return pages * LX_PAGE_SIZE;
+}
+
+// unpack all pages of the object (0-based index) into contiguous dst
+int lx_unpack_object(const lx_module_t *mod, uint32_t obj, uint8_t *dst, uint32_t dst_size)
+{
+    uint32_t size = lx_object_size(mod, obj);
+    uint32_t i, pos;
+    int rc;
+
+    if (obj >= mod->hdr->objcnt)
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    if (dst_size < mod->obj[obj].size)
+    {
+        return LX_MOD_ERR_MEM;
+    }
+    if (dst_size < size)
+    {
+        size = dst_size;
+    }
+    // pages are decoded straight into their place within the object,
+    // the last one may be cut
+    for (i = 0, pos = 0; (i < mod->obj[obj].mapsize) && (pos < size); i++, pos += LX_PAGE_SIZE)
+    {
+        rc = lx_unpack_page_span(mod, mod->obj[obj].pagemap - 1 + i, dst + pos, size - pos);
+        if (rc != LX_MOD_OK)
+        {
+            return rc;
+        }
+    }
+    // pages not present in file are zeroed
+    if (pos < size)
+    {
+        memset(dst + pos, 0, size - pos);
+    }
+    return LX_MOD_OK;
+}
+
+// unpack all objects, objects[i] must hold lx_object_size(mod, i) bytes
+int lx_unpack_module(const lx_module_t *mod, uint8_t *const *objects)
+{
+    uint32_t i;
+    int rc;
+
+    for (i = 0; i < mod->hdr->objcnt; i++)
+    {
+        rc = lx_unpack_object(mod, i, objects[i], lx_object_size(mod, i));
+        if (rc != LX_MOD_OK)
+        {
+            return rc;
+        }
+    }
+    return LX_MOD_OK;
+}
+
+#endif // LX_MODULE_IMPLEMENTATION
+
+#endif // __H_LX_MODULE__
@@ -0,0 +1,660 @@
+// SPDX-License-Identifier: MIT
+#ifndef __H_LX_PACK__
+#define __H_LX_PACK__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "lxunpack.h"
+
+// packing levels
+#define LX_PACK_FAST                   1       // greedy, single hash probe
+#define LX_PACK_DEFAULT                2       // lazy matching, short hash chains
+#define LX_PACK_MAX                    3       // optimal parse over long hash chains
+
+// pack one page (up to LX_PAGE_SIZE bytes) with EXEPACK:2,
+// returns packed size or -1 if it does not fit into dst_size bytes
+int16_t lx_pack2(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size, int level);
+// pack one page (up to LX_PAGE_SIZE bytes) with EXEPACK:1,
+// returns packed size or -1 if it does not fit into dst_size bytes
+int16_t lx_pack1(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef LX_PACK_IMPLEMENTATION
+
+// EXEPACK:2 token limits, see lx_unpack2
+#define LX_PACK_MAX_LIT                63      // literal run token
+#define LX_PACK_MAX_FILL               255     // iterated bytes token
+#define LX_PACK_MIN_MATCH              3
+#define LX_PACK_SHORT_LEN              10      // short string token
+#define LX_PACK_SHORT_OFF              511
+#define LX_PACK_SHORT_NR               3
+#define LX_PACK_MID_LEN                6       // mid string token
+#define LX_PACK_LONG_LEN               63      // long string token
+#define LX_PACK_LONG_NR                15
+#define LX_PACK_MAX_OFF                (LX_PAGE_SIZE - 1)
+
+// longest repeated pattern the EXEPACK:1 packer looks for
+#define LX_PACK1_MAX_PERIOD            64
+
+// string token kinds
+#define LX_TOK_SHORT                   0
+#define LX_TOK_MID                     1
+#define LX_TOK_LONG                    2
+
+// hash chains of 3-byte prefixes
+#define LX_PACK_HASH_BITS              12
+#define LX_PACK_HASH_SIZE              (1 << LX_PACK_HASH_BITS)
+
+// chain depth of the default and max levels
+#define LX_PACK_DEFAULT_DEPTH          16
+#define LX_PACK_MAX_DEPTH              256
+
+// fast level probes every 2nd position after 16 misses in a row, and so on
+#define LX_PACK_SKIP_SHIFT             4
+
+// header bytes of the literal run tokens for n bytes
+#define LX_LIT_HDR(n)                  (((n) + LX_PACK_MAX_LIT - 1) / LX_PACK_MAX_LIT)
+
+// packer state for one page
+typedef struct lx_pack_s
+{
+    const uint8_t  *src;
+    uint16_t        size;        // input size
+    uint8_t        *dst;
+    uint16_t        dst_size;    // output buffer size
+    uint16_t        out;         // bytes written so far
+    uint16_t        head[LX_PACK_HASH_SIZE];  // last position + 1 with that hash
+    uint16_t        prev[LX_PAGE_SIZE];       // previous position + 1 with same hash
+} lx_pack_t;
+
+static uint16_t lx_pack_hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+
+    return (uint16_t)((uint32_t)(v * 2654435761UL) >> (32 - LX_PACK_HASH_BITS));
+}
+
+// add position to the hash chains
+static void lx_pack_insert(lx_pack_t *st, uint16_t pos)
+{
+    uint16_t h;
+
+    if (pos + LX_PACK_MIN_MATCH <= st->size)
+    {
+        h = lx_pack_hash(st->src + pos);
+        st->prev[pos] = st->head[h];
+        st->head[h] = pos + 1;
+    }
+}
+
+// longest earlier string matching at pos, walks up to depth chain entries.
+// Match may overlap pos, as the decoder copies byte by byte.
+// *short_len/*short_off receive the longest one, usable by the short token
+static uint16_t lx_pack_find(lx_pack_t *st, uint16_t pos, uint16_t depth, uint16_t *off,
+                             uint16_t *short_len, uint16_t *short_off)
+{
+    const uint8_t *src = st->src;
+    uint16_t limit = st->size - pos;
+    uint16_t best = 0;
+    uint16_t cand, len, o;
+
+    *short_len = 0;
+    if (limit < LX_PACK_MIN_MATCH)
+    {
+        return 0;
+    }
+    if (limit > LX_PACK_LONG_LEN)
+    {
+        limit = LX_PACK_LONG_LEN;
+    }
+    // chains go from nearest to farthest positions
+    for (cand = st->head[lx_pack_hash(src + pos)]; cand && depth; cand = st->prev[cand - 1], depth--)
+    {
+        o = pos - (cand - 1);
+        if (best == limit)
+        {
+            // only a short token candidate is still of interest,
+            // offsets grow along the chain
+            if (*short_len || (o > LX_PACK_SHORT_OFF))
+            {
+                break;
+            }
+        }
+        else if ((src[cand - 1 + best] != src[pos + best]) && (*short_len || (o > LX_PACK_SHORT_OFF)))
+        {
+            // can't be longer than the best one
+            continue;
+        }
+        for (len = 0; (len < limit) && (src[cand - 1 + len] == src[pos + len]); len++);
+        if ((o <= LX_PACK_SHORT_OFF) && (len > *short_len))
+        {
+            *short_len = len;
+            *short_off = o;
+        }
+        if (len > best)
+        {
+            best = len;
+            *off = o;
+        }
+    }
+    return (best >= LX_PACK_MIN_MATCH) ? best : 0;
+}
+
+// length of the run of equal bytes at pos
+static uint16_t lx_pack_run(lx_pack_t *st, uint16_t pos)
+{
+    uint16_t run;
+
+    for (run = 1; (pos + run < st->size) && (run < LX_PACK_MAX_FILL) &&
+                  (st->src[pos + run] == st->src[pos]); run++);
+    return run;
+}
+
+// size of the cheapest string token, carrying n pending literals with it,
+// including literal run tokens for the literals which do not fit into it
+static uint16_t lx_pack_tok_size(uint16_t n, uint16_t len, uint16_t off, uint8_t *kind)
+{
+    uint16_t best = 0xFFFF;
+    uint16_t size;
+
+    if ((len <= LX_PACK_SHORT_LEN) && (off <= LX_PACK_SHORT_OFF))
+    {
+        best = LX_LIT_HDR(n - ((n < LX_PACK_SHORT_NR) ? n : LX_PACK_SHORT_NR)) + n + 2;
+        *kind = LX_TOK_SHORT;
+    }
+    if (len <= LX_PACK_MID_LEN)
+    {
+        size = LX_LIT_HDR(n) + n + 2;
+        if (size < best)
+        {
+            best = size;
+            *kind = LX_TOK_MID;
+        }
+    }
+    size = LX_LIT_HDR(n - ((n < LX_PACK_LONG_NR) ? n : LX_PACK_LONG_NR)) + n + 3;
+    if (size < best)
+    {
+        best = size;
+        *kind = LX_TOK_LONG;
+    }
+    return best;
+}
+
+// append bytes to the output
+static int lx_pack_put(lx_pack_t *st, const uint8_t *buf, uint16_t len)
+{
+    if (len > st->dst_size - st->out)
+    {
+        return -1;
+    }
+    for (; len > 0; len--)
+    {
+        st->dst[st->out++] = *buf++;
+    }
+    return 0;
+}
+
+// literal run tokens for n bytes at pos
+static int lx_pack_lit(lx_pack_t *st, uint16_t pos, uint16_t n)
+{
+    uint8_t hdr;
+    uint16_t k;
+
+    for (; n > 0; n -= k, pos += k)
+    {
+        k = (n > LX_PACK_MAX_LIT) ? LX_PACK_MAX_LIT : n;
+        hdr = (uint8_t)(k << 2);
+        if (lx_pack_put(st, &hdr, 1) || lx_pack_put(st, st->src + pos, k))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// n pending literals at pos, then iterated bytes token for the run following them
+static int lx_pack_fill(lx_pack_t *st, uint16_t pos, uint16_t n, uint16_t run)
+{
+    uint8_t tok[3];
+
+    tok[0] = 0;
+    tok[1] = (uint8_t)run;
+    tok[2] = st->src[pos + n];
+    return (lx_pack_lit(st, pos, n) || lx_pack_put(st, tok, 3)) ? -1 : 0;
+}
+
+// n pending literals at pos, then string token of given kind following them.
+// Literals which do not fit into the token go into literal runs first
+static int lx_pack_tok(lx_pack_t *st, uint16_t pos, uint16_t n, uint8_t kind, uint16_t len, uint16_t off)
+{
+    uint8_t tok[3];
+    uint16_t nr = 0;
+    uint16_t size;
+
+    switch (kind)
+    {
+        case LX_TOK_SHORT:
+            nr = (n < LX_PACK_SHORT_NR) ? n : LX_PACK_SHORT_NR;
+            tok[0] = (uint8_t)(1 | (nr << 2) | ((len - 3) << 4) | ((off & 1) << 7));
+            tok[1] = (uint8_t)(off >> 1);
+            size = 2;
+            break;
+
+        case LX_TOK_MID:
+            tok[0] = (uint8_t)(2 | ((len - 3) << 2) | ((off & 0x0F) << 4));
+            tok[1] = (uint8_t)(off >> 4);
+            size = 2;
+            break;
+
+        default:
+            nr = (n < LX_PACK_LONG_NR) ? n : LX_PACK_LONG_NR;
+            tok[0] = (uint8_t)(3 | (nr << 2) | ((len & 3) << 6));
+            tok[1] = (uint8_t)((len >> 2) | ((off & 0x0F) << 4));
+            tok[2] = (uint8_t)(off >> 4);
+            size = 3;
+            break;
+    }
+    if ( lx_pack_lit(st, pos, n - nr) ||
+         lx_pack_put(st, tok, size)   ||
+         lx_pack_put(st, st->src + pos + n - nr, nr)
+       )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// best token at pos with n literals pending: string or iterated bytes.
+// Returns the number of bytes it saves against the literals, 0 if none
+static int16_t lx_pack_choose(lx_pack_t *st, uint16_t pos, uint16_t n, uint16_t depth,
+                              uint16_t *len, uint16_t *off, uint8_t *kind, int *fill)
+{
+    uint16_t mlen, moff, slen, soff, run;
+    uint16_t lit_size = n + LX_LIT_HDR(n);
+    int16_t gain = 0, g;
+    uint8_t k;
+
+    mlen = lx_pack_find(st, pos, depth, &moff, &slen, &soff);
+    if (mlen)
+    {
+        gain = (int16_t)mlen - (int16_t)(lx_pack_tok_size(n, mlen, moff, kind) - lit_size);
+        *len = mlen;
+        *off = moff;
+        *fill = 0;
+        // shorter match may still be better, if it fits into the short token
+        if (slen > LX_PACK_SHORT_LEN)
+        {
+            slen = LX_PACK_SHORT_LEN;
+        }
+        if (slen >= LX_PACK_MIN_MATCH)
+        {
+            g = (int16_t)slen - (int16_t)(lx_pack_tok_size(n, slen, soff, &k) - lit_size);
+            if (g > gain)
+            {
+                gain = g;
+                *len = slen;
+                *off = soff;
+                *kind = k;
+            }
+        }
+    }
+    run = lx_pack_run(st, pos);
+    if (run > LX_PACK_MIN_MATCH)
+    {
+        g = (int16_t)run - 3;
+        if (g > gain)
+        {
+            gain = g;
+            *len = run;
+            *fill = 1;
+        }
+    }
+    return gain;
+}
+
+// greedy parse with single hash probe for the fast level,
+// lazy parse over short hash chains for the default one
+static int lx_pack2_greedy(lx_pack_t *st, int level)
+{
+    uint16_t depth = (level == LX_PACK_FAST) ? 1 : LX_PACK_DEFAULT_DEPTH;
+    uint16_t pos = 0;            // current position
+    uint16_t lit = 0;            // start of pending literals
+    uint16_t ins = 0;            // next position to add to the hash chains
+    uint16_t miss = 0;           // positions without match in a row
+    uint16_t len, off, len1, off1;
+    uint8_t kind, kind1;
+    int fill, fill1;
+    int16_t gain;
+
+    while (pos < st->size)
+    {
+        if (level == LX_PACK_FAST)
+        {
+            // only probed positions are indexed
+            ins = pos;
+        }
+        for (; ins < pos; ins++)
+        {
+            lx_pack_insert(st, ins);
+        }
+        gain = lx_pack_choose(st, pos, pos - lit, depth, &len, &off, &kind, &fill);
+        if ((gain > 0) && (level != LX_PACK_FAST) && (pos + 1 < st->size))
+        {
+            // leave this one, if next position is better
+            lx_pack_insert(st, ins++);
+            if (lx_pack_choose(st, pos + 1, pos + 1 - lit, depth, &len1, &off1, &kind1, &fill1) > gain)
+            {
+                gain = 0;
+            }
+        }
+        if (level == LX_PACK_FAST)
+        {
+            lx_pack_insert(st, pos);
+        }
+        if (gain <= 0)
+        {
+            // literal, fast level probes less often within incompressible data
+            pos += (level == LX_PACK_FAST) ? 1 + (miss++ >> LX_PACK_SKIP_SHIFT) : 1;
+            if (pos > st->size)
+            {
+                pos = st->size;
+            }
+            continue;
+        }
+        miss = 0;
+        if (fill)
+        {
+            if (lx_pack_fill(st, lit, pos - lit, len))
+            {
+                return -1;
+            }
+        }
+        else if (lx_pack_tok(st, lit, pos - lit, kind, len, off))
+        {
+            return -1;
+        }
+        pos += len;
+        lit = pos;
+    }
+    return lx_pack_lit(st, lit, pos - lit);
+}
+
+// optimal parse choices
+#define LX_HOW_LIT                     0       // literal run
+#define LX_HOW_FILL                    1       // iterated bytes
+#define LX_HOW_TOK                     2       // LX_HOW_TOK + LX_TOK_xxx, string token
+
+// dynamic programming over all positions, from the end of the page:
+// cost[pos] is the least packed size of the bytes from pos to the end
+static int lx_pack2_optimal(lx_pack_t *st)
+{
+    uint16_t cost[LX_PAGE_SIZE + 1];
+    uint16_t tcost[3][LX_PAGE_SIZE];   // best cost starting with the string token kind
+    uint8_t  tlen[3][LX_PAGE_SIZE];    // its match length
+    uint16_t moff[2][LX_PAGE_SIZE];    // offsets of the longest short and any match
+    uint8_t  mlen[2][LX_PAGE_SIZE];    // lengths of them
+    uint8_t  run[LX_PAGE_SIZE];        // run of equal bytes
+    uint8_t  how[LX_PAGE_SIZE];        // chosen step
+    uint8_t  arg[LX_PAGE_SIZE];        // its length or literal prefix
+    uint16_t size = st->size;
+    uint16_t pos, k, c, m, lim, slen;
+    uint16_t soff = 0;
+    uint8_t kind;
+
+    // all matches first, chains must hold previous positions only
+    for (pos = 0; pos < size; pos++)
+    {
+        mlen[1][pos] = (uint8_t)lx_pack_find(st, pos, LX_PACK_MAX_DEPTH, &moff[1][pos], &slen, &soff);
+        mlen[0][pos] = (uint8_t)((slen >= LX_PACK_MIN_MATCH) ? slen : 0);
+        moff[0][pos] = soff;
+        lx_pack_insert(st, pos);
+    }
+    cost[size] = 0;
+    for (pos = size; pos-- > 0;)
+    {
+        run[pos] = (uint8_t)(((pos + 1 < size) && (st->src[pos + 1] == st->src[pos]) &&
+                              (run[pos + 1] < LX_PACK_MAX_FILL)) ? run[pos + 1] + 1 : 1);
+        // single string tokens starting here
+        for (kind = LX_TOK_SHORT; kind <= LX_TOK_LONG; kind++)
+        {
+            tcost[kind][pos] = 0xFFFF;
+            lim = mlen[kind == LX_TOK_SHORT ? 0 : 1][pos];
+            if (kind == LX_TOK_SHORT && lim > LX_PACK_SHORT_LEN)
+            {
+                lim = LX_PACK_SHORT_LEN;
+            }
+            if (kind == LX_TOK_MID && lim > LX_PACK_MID_LEN)
+            {
+                lim = LX_PACK_MID_LEN;
+            }
+            for (k = LX_PACK_MIN_MATCH; k <= lim; k++)
+            {
+                c = cost[pos + k] + ((kind == LX_TOK_LONG) ? 3 : 2);
+                if (c < tcost[kind][pos])
+                {
+                    tcost[kind][pos] = c;
+                    tlen[kind][pos] = (uint8_t)k;
+                }
+            }
+        }
+        // literal run
+        cost[pos] = 0xFFFF;
+        for (k = 1; (k <= LX_PACK_MAX_LIT) && (pos + k <= size); k++)
+        {
+            c = cost[pos + k] + k + 1;
+            if (c < cost[pos])
+            {
+                cost[pos] = c;
+                how[pos] = LX_HOW_LIT;
+                arg[pos] = (uint8_t)k;
+            }
+        }
+        // iterated bytes
+        for (k = LX_PACK_MIN_MATCH; k <= run[pos]; k++)
+        {
+            c = cost[pos + k] + 3;
+            if (c < cost[pos])
+            {
+                cost[pos] = c;
+                how[pos] = LX_HOW_FILL;
+                arg[pos] = (uint8_t)k;
+            }
+        }
+        // string tokens, with up to 3 or 15 literals ahead of them
+        for (kind = LX_TOK_SHORT; kind <= LX_TOK_LONG; kind++)
+        {
+            lim = (kind == LX_TOK_SHORT) ? LX_PACK_SHORT_NR : (kind == LX_TOK_LONG) ? LX_PACK_LONG_NR : 0;
+            for (m = 0; (m <= lim) && (pos + m < size); m++)
+            {
+                if (tcost[kind][pos + m] != 0xFFFF)
+                {
+                    c = tcost[kind][pos + m] + m;
+                    if (c < cost[pos])
+                    {
+                        cost[pos] = c;
+                        how[pos] = LX_HOW_TOK + kind;
+                        arg[pos] = (uint8_t)m;
+                    }
+                }
+            }
+        }
+    }
+    // emit chosen steps
+    for (pos = 0; pos < size; pos += k)
+    {
+        switch (how[pos])
+        {
+            case LX_HOW_LIT:
+                k = arg[pos];
+                if (lx_pack_lit(st, pos, k))
+                {
+                    return -1;
+                }
+                break;
+
+            case LX_HOW_FILL:
+                k = arg[pos];
+                if (lx_pack_fill(st, pos, 0, k))
+                {
+                    return -1;
+                }
+                break;
+
+            default:
+                kind = how[pos] - LX_HOW_TOK;
+                m = arg[pos];
+                k = tlen[kind][pos + m];
+                if (lx_pack_tok(st, pos, m, kind, k, moff[kind == LX_TOK_SHORT ? 0 : 1][pos + m]))
+                {
+                    return -1;
+                }
+                k += m;
+                break;
+        }
+    }
+    return 0;
+}
+
+// pack one page (up to LX_PAGE_SIZE bytes) with EXEPACK:2
+int16_t lx_pack2(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size, int level)
+{
+    lx_pack_t st;
+    uint16_t i;
+    int rc;
+
+    if ((src_size < 0) || (src_size > LX_PAGE_SIZE) || (dst_size < 0))
+    {
+        return -1;
+    }
+    st.src = src;
+    st.size = (uint16_t)src_size;
+    st.dst = dst;
+    st.dst_size = (uint16_t)dst_size;
+    st.out = 0;
+    for (i = 0; i < LX_PACK_HASH_SIZE; i++)
+    {
+        st.head[i] = 0;
+    }
+    switch (level)
+    {
+        case LX_PACK_MAX:
+            rc = lx_pack2_optimal(&st);
+            break;
+
+        case LX_PACK_FAST:
+            rc = lx_pack2_greedy(&st, LX_PACK_FAST);
+            break;
+
+        default:
+            rc = lx_pack2_greedy(&st, LX_PACK_DEFAULT);
+            break;
+    }
+    return rc ? -1 : (int16_t)st.out;
+}
+
+// append one EXEPACK:1 record: nr repetitions of len bytes at src
+static int lx_pack1_put(uint8_t *dst, uint16_t dst_size, uint16_t *out,
+                        const uint8_t *src, uint16_t nr, uint16_t len)
+{
+    uint16_t i;
+
+    if (len + 4 > dst_size - *out)
+    {
+        return -1;
+    }
+    dst += *out;
+    dst[0] = (uint8_t)nr;
+    dst[1] = (uint8_t)(nr >> 8);
+    dst[2] = (uint8_t)len;
+    dst[3] = (uint8_t)(len >> 8);
+    for (i = 0; i < len; i++)
+    {
+        dst[4 + i] = src[i];
+    }
+    *out += len + 4;
+    return 0;
+}
+
+// pack one page (up to LX_PAGE_SIZE bytes) with EXEPACK:1.
+// Page is split into literal records and repeated patterns of up to
+// LX_PACK1_MAX_PERIOD bytes with the least packed size, from the end of
+// the page. Lengths of the periodic runs at each position are updated from
+// the next position, so the time is linear in the page size.
+int16_t lx_pack1(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size)
+{
+    uint16_t best[LX_PAGE_SIZE + 1];   // least size of the rest, new record starts here
+    uint16_t lit[LX_PAGE_SIZE + 1];    // same, within literal record already started
+    uint16_t count[LX_PAGE_SIZE];      // repetitions of the chosen pattern
+    uint8_t  period[LX_PAGE_SIZE];     // length of the chosen pattern, 0 - literal record
+    uint8_t  more[LX_PAGE_SIZE];       // literal record goes on after this byte
+    uint16_t eq[LX_PACK1_MAX_PERIOD + 1];  // src[pos + k] == src[pos + k + p] for k < eq[p]
+    uint16_t size, pos, end, p, r, c;
+    uint16_t out = 0;
+
+    if ((src_size < 0) || (src_size > LX_PAGE_SIZE) || (dst_size < 0))
+    {
+        return -1;
+    }
+    size = (uint16_t)src_size;
+    for (p = 1; p <= LX_PACK1_MAX_PERIOD; p++)
+    {
+        eq[p] = 0;
+    }
+    best[size] = 0;
+    lit[size] = 0xFFFF;
+    for (pos = size; pos-- > 0;)
+    {
+        // literal byte, ending the record here or not
+        more[pos] = (uint8_t)(lit[pos + 1] < best[pos + 1]);
+        lit[pos] = 1 + (more[pos] ? lit[pos + 1] : best[pos + 1]);
+        best[pos] = lit[pos] + 4;
+        period[pos] = 0;
+        // longest run of each pattern length starting here
+        for (p = 1; p <= LX_PACK1_MAX_PERIOD; p++)
+        {
+            eq[p] = ((pos + p < size) && (src[pos] == src[pos + p])) ? eq[p] + 1 : 0;
+            if (eq[p] >= p)
+            {
+                r = 1 + eq[p] / p;
+                c = best[pos + r * p] + p + 4;
+                if (c < best[pos])
+                {
+                    best[pos] = c;
+                    period[pos] = (uint8_t)p;
+                    count[pos] = r;
+                }
+            }
+        }
+    }
+    for (pos = 0; pos < size;)
+    {
+        if (period[pos])
+        {
+            if (lx_pack1_put((uint8_t *)dst, (uint16_t)dst_size, &out, src + pos, count[pos], period[pos]))
+            {
+                return -1;
+            }
+            pos += count[pos] * period[pos];
+        }
+        else
+        {
+            for (end = pos; more[end]; end++);
+            if (lx_pack1_put((uint8_t *)dst, (uint16_t)dst_size, &out, src + pos, 1, end + 1 - pos))
+            {
+                return -1;
+            }
+            pos = end + 1;
+        }
+    }
+    return (int16_t)out;
+}
+
+#endif // LX_PACK_IMPLEMENTATION
+
+#endif // __H_LX_PACK__
@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: MIT
+#ifndef __H_LX_PARALLEL__
+#define __H_LX_PARALLEL__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "lxmodule.h"
+
+// Page-parallel unpacking of LX modules on the host (pthreads).
+// Pages never depend on each other, so all pages of a batch of modules are
+// spread over a pool of workers. Each worker owns a range of pages and steals
+// half of the biggest remaining range of another worker when its own is done.
+// Requires LX_MODULE_IMPLEMENTATION and LX_UNPACK_IMPLEMENTATION somewhere.
+
+// one module of the batch
+typedef struct lx_batch_s
+{
+    const lx_module_t *mod;      // opened module
+    uint8_t *const    *objects;  // objects[i] holds lx_object_size(mod, i) bytes
+    int                rc;       // LX_MOD_xxx result for that module
+} lx_batch_t;
+
+// unpack all modules of the batch with given number of threads (0 - one per CPU),
+// returns LX_MOD_OK or the first error, per-module results are in batch[i].rc
+int lx_unpack_parallel(lx_batch_t *batch, uint32_t count, uint32_t threads);
+// same for one module
+int lx_unpack_module_parallel(const lx_module_t *mod, uint8_t *const *objects, uint32_t threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef LX_PARALLEL_IMPLEMENTATION
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// C++ has no <stdatomic.h> before C++23, same operations come from <atomic>
+#ifdef __cplusplus
+#include <atomic>
+#define LX_ATOMIC(type)                std::atomic<type>
+using std::atomic_load;
+using std::atomic_load_explicit;
+using std::atomic_store;
+using std::atomic_compare_exchange_weak;
+using std::atomic_compare_exchange_strong;
+using std::memory_order_relaxed;
+#else
+#include <stdatomic.h>
+#define LX_ATOMIC(type)                _Atomic type
+#endif
+
+// single page to unpack
+typedef struct lx_ptask_s
+{
+    uint32_t    batch;           // index of the module in batch
+    uint32_t    page;            // object page table index
+    uint8_t    *dst;             // final place of the page within the object
+} lx_ptask_t;
+
+// work shared by all workers
+typedef struct lx_pool_s
+{
+    lx_batch_t          *batch;
+    lx_ptask_t          *task;
+    LX_ATOMIC(uint64_t) *range;  // per worker task range, hi << 32 | lo
+    LX_ATOMIC(int)      *rc;     // per module result
+    uint32_t             workers;
+} lx_pool_t;
+
+typedef struct lx_worker_s
+{
+    lx_pool_t   *pool;
+    uint32_t     id;
+    pthread_t    thread;
+} lx_worker_t;
+
+#define LX_RANGE(lo, hi)               (((uint64_t)(hi) << 32) | (uint32_t)(lo))
+#define LX_RANGE_LO(r)                 ((uint32_t)(r))
+#define LX_RANGE_HI(r)                 ((uint32_t)((r) >> 32))
+
+// take one task from the own range, from its low end
+static int lx_pool_take(lx_pool_t *pool, uint32_t id, uint32_t *task)
+{
+    uint64_t r = atomic_load(&pool->range[id]);
+
+    while (LX_RANGE_LO(r) < LX_RANGE_HI(r))
+    {
+        if (atomic_compare_exchange_weak(&pool->range[id], &r, LX_RANGE(LX_RANGE_LO(r) + 1, LX_RANGE_HI(r))))
+        {
+            *task = LX_RANGE_LO(r);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// move upper half of the largest range of other workers into the own range
+static int lx_pool_steal(lx_pool_t *pool, uint32_t id)
+{
+    uint64_t r;
+    uint32_t victim, best, left, most;
+    uint32_t i;
+
+    for (;;)
+    {
+        most = 0;
+        best = id;
+        for (i = 1; i < pool->workers; i++)
+        {
+            victim = (id + i) % pool->workers;
+            r = atomic_load(&pool->range[victim]);
+            if (LX_RANGE_HI(r) - LX_RANGE_LO(r) > most)
+            {
+                most = LX_RANGE_HI(r) - LX_RANGE_LO(r);
+                best = victim;
+            }
+        }
+        if (!most)
+        {
+            // nothing left anywhere, tasks are never added
+            return 0;
+        }
+        r = atomic_load(&pool->range[best]);
+        if (LX_RANGE_LO(r) >= LX_RANGE_HI(r))
+        {
+            continue;
+        }
+        // victim keeps [lo, left), thief gets [left, hi)
+        left = LX_RANGE_HI(r) - (LX_RANGE_HI(r) - LX_RANGE_LO(r) + 1) / 2;
+        if (atomic_compare_exchange_strong(&pool->range[best], &r, LX_RANGE(LX_RANGE_LO(r), left)))
+        {
+            atomic_store(&pool->range[id], LX_RANGE(left, LX_RANGE_HI(r)));
+            return 1;
+        }
+    }
+}
+
+static void *lx_pool_worker(void *arg)
+{
+    lx_worker_t *w = (lx_worker_t *)arg;
+    lx_pool_t *pool = w->pool;
+    lx_ptask_t *t;
+    uint32_t task;
+    int ok, rc;
+
+    do
+    {
+        while (lx_pool_take(pool, w->id, &task))
+        {
+            t = &pool->task[task];
+            // skip the rest of the module once it has failed
+            if (atomic_load_explicit(&pool->rc[t->batch], memory_order_relaxed) != LX_MOD_OK)
+            {
+                continue;
+            }
+            rc = lx_unpack_page(pool->batch[t->batch].mod, t->page, t->dst);
+            if (rc != LX_MOD_OK)
+            {
+                ok = LX_MOD_OK;
+                atomic_compare_exchange_strong(&pool->rc[t->batch], &ok, rc);
+            }
+        }
+    }
+    while (lx_pool_steal(pool, w->id));
+    return NULL;
+}
+
+// unpack all modules of the batch with given number of threads (0 - one per CPU)
+int lx_unpack_parallel(lx_batch_t *batch, uint32_t count, uint32_t threads)
+{
+    lx_pool_t pool;
+    lx_worker_t *worker = NULL;
+    const lx_module_t *mod;
+    const lx_obj_t *obj;
+    uint32_t tasks = 0;
+    uint32_t b, i, p, size;
+    uint8_t *dst;
+    int rc = LX_MOD_OK;
+    long cpus;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.batch = batch;
+    for (b = 0; b < count; b++)
+    {
+        batch[b].rc = LX_MOD_OK;
+        for (i = 0; i < batch[b].mod->hdr->objcnt; i++)
+        {
+            tasks += batch[b].mod->obj[i].mapsize;
+        }
+    }
+    if (!threads)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+    if (threads > tasks)
+    {
+        threads = tasks ? tasks : 1;
+    }
+    pool.workers = threads;
+    pool.task = (lx_ptask_t *)malloc(((size_t)tasks + 1) * sizeof(lx_ptask_t));
+    pool.range = (LX_ATOMIC(uint64_t) *)malloc(threads * sizeof(*pool.range));
+    pool.rc = (LX_ATOMIC(int) *)malloc(((size_t)count + 1) * sizeof(*pool.rc));
+    worker = (lx_worker_t *)malloc(threads * sizeof(lx_worker_t));
+    if (!pool.task || !pool.range || !pool.rc || !worker)
+    {
+        rc = LX_MOD_ERR_MEM;
+        goto done;
+    }
+    // list all pages with their final places, zero the pages not in file
+    tasks = 0;
+    for (b = 0; b < count; b++)
+    {
+        mod = batch[b].mod;
+        atomic_store(&pool.rc[b], LX_MOD_OK);
+        for (i = 0; i < mod->hdr->objcnt; i++)
+        {
+            obj = &mod->obj[i];
+            dst = batch[b].objects[i];
+            size = lx_object_size(mod, i);
+            for (p = 0; p < obj->mapsize; p++)
+            {
+                pool.task[tasks].batch = b;
+                pool.task[tasks].page = obj->pagemap - 1 + p;
+                pool.task[tasks].dst = dst + p * LX_PAGE_SIZE;
+                tasks++;
+            }
+            memset(dst + p * LX_PAGE_SIZE, 0, size - p * LX_PAGE_SIZE);
+        }
+    }
+    // equal initial shares, stealing evens out the rest
+    for (i = 0; i < threads; i++)
+    {
+        atomic_store(&pool.range[i], LX_RANGE((uint64_t)tasks * i / threads, (uint64_t)tasks * (i + 1) / threads));
+        worker[i].pool = &pool;
+        worker[i].id = i;
+    }
+    // calling thread is worker 0, range of a worker failed to start
+    // is stolen by the others
+    for (i = 1; i < threads; i++)
+    {
+        if (pthread_create(&worker[i].thread, NULL, lx_pool_worker, &worker[i]))
+        {
+            worker[i].pool = NULL;
+        }
+    }
+    lx_pool_worker(&worker[0]);
+    for (i = 1; i < threads; i++)
+    {
+        if (worker[i].pool)
+        {
+            pthread_join(worker[i].thread, NULL);
+        }
+    }
+    for (b = 0; b < count; b++)
+    {
+        batch[b].rc = atomic_load(&pool.rc[b]);
+        if ((rc == LX_MOD_OK) && (batch[b].rc != LX_MOD_OK))
+        {
+            rc = batch[b].rc;
+        }
+    }
+
+done:
+    free(worker);
+    free((void *)pool.rc);
+    free((void *)pool.range);
+    free(pool.task);
+    return rc;
+}
+
+// same for one module
+int lx_unpack_module_parallel(const lx_module_t *mod, uint8_t *const *objects, uint32_t threads)
+{
+    lx_batch_t batch;
+
+    batch.mod = mod;
+    batch.objects = objects;
+    return lx_unpack_parallel(&batch, 1, threads);
+}
+
+#endif // LX_PARALLEL_IMPLEMENTATION
+
+#endif // __H_LX_PARALLEL__
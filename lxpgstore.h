@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: MIT
+#ifndef __H_LX_PGSTORE__
+#define __H_LX_PGSTORE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include "lxmodule.h"
+
+// Store of unpacked LX pages shared by content (pthreads).
+// Page is keyed by a 128-bit hash of its LX_PAGE_SIZE bytes, identical pages
+// of any modules are kept once and counted by references, so many versions of
+// the same modules take little more memory than one. Pages are hashed and
+// unpacked with the store unlocked, only the table lookup is under the lock.
+// Requires LX_MODULE_IMPLEMENTATION and LX_UNPACK_IMPLEMENTATION.
+
+typedef struct lx_spage_s lx_spage_t;
+
+typedef struct lx_pgstore_s
+{
+    pthread_mutex_t     lock;
+    lx_spage_t        **hash;    // buckets of the page hashes
+    uint32_t            mask;    // number of buckets - 1
+    uint32_t            pages;   // distinct pages held
+    uint64_t            refs;    // references to them
+} lx_pgstore_t;
+
+// store counters
+typedef struct lx_pgstore_stats_s
+{
+    uint32_t            pages;   // distinct pages held
+    uint64_t            refs;    // pages held by users, with duplicates
+    uint64_t            bytes;   // unpacked size of the referenced pages
+    uint64_t            resident;  // memory held by the store
+    double              ratio;   // refs per distinct page
+} lx_pgstore_stats_t;
+
+// create empty store, sized for about pages distinct pages
+int lx_pgstore_init(lx_pgstore_t *store, uint32_t pages);
+// free all pages, none may be in use
+void lx_pgstore_done(lx_pgstore_t *store);
+// shared copy of LX_PAGE_SIZE bytes of page, NULL if out of memory.
+// Copy is read-only and stays until lx_pgstore_release
+const uint8_t *lx_pgstore_put(lx_pgstore_t *store, const uint8_t *page);
+// unpack page (0-based object page table index) of the module into the store,
+// NULL on error
+const uint8_t *lx_pgstore_unpack(lx_pgstore_t *store, const lx_module_t *mod, uint32_t page);
+// all pages of the module, pages[i] for object page table entry i.
+// Returns LX_MOD_OK, or error with no pages taken
+int lx_pgstore_module(lx_pgstore_t *store, const lx_module_t *mod, const uint8_t **pages);
+// one more reference to the stored page
+void lx_pgstore_addref(lx_pgstore_t *store, const uint8_t *data);
+// end of the page use, page is freed with its last reference
+void lx_pgstore_release(lx_pgstore_t *store, const uint8_t *data);
+// current counters
+void lx_pgstore_stats(lx_pgstore_t *store, lx_pgstore_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef LX_PGSTORE_IMPLEMENTATION
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct lx_spage_s
+{
+    lx_spage_t         *hnext;   // next in the bucket
+    uint64_t            h[2];    // content hash
+    uint32_t            refs;
+    uint8_t             data[LX_PAGE_SIZE];
+};
+
+#define LX_PGS_P1                      0x9E3779B185EBCA87ULL
+#define LX_PGS_P2                      0xC2B2AE3D27D4EB4FULL
+#define LX_PGS_P3                      0x165667B19E3779F9ULL
+#define LX_PGS_ROTL(x, r)              (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t lx_pgs_round(uint64_t acc, uint64_t v)
+{
+    acc += v * LX_PGS_P2;
+    acc = LX_PGS_ROTL(acc, 31);
+    return acc * LX_PGS_P1;
+}
+
+static uint64_t lx_pgs_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= LX_PGS_P2;
+    h ^= h >> 29;
+    h *= LX_PGS_P3;
+    return h ^ (h >> 32);
+}
+
+// 128-bit hash of the page, four independent lanes of 64-bit words
+static void lx_pgs_hash(const uint8_t *page, uint64_t h[2])
+{
+    uint64_t v[4], w[4];
+    uint32_t i, j;
+
+    v[0] = LX_PGS_P1 + LX_PGS_P2;
+    v[1] = LX_PGS_P2;
+    v[2] = 0;
+    v[3] = 0 - LX_PGS_P1;
+    for (i = 0; i < LX_PAGE_SIZE; i += sizeof(w))
+    {
+        memcpy(w, page + i, sizeof(w));
+        for (j = 0; j < 4; j++)
+        {
+            v[j] = lx_pgs_round(v[j], w[j]);
+        }
+    }
+    h[0] = lx_pgs_mix(LX_PGS_ROTL(v[0], 1) + LX_PGS_ROTL(v[1], 7) + LX_PGS_ROTL(v[2], 12) + LX_PGS_ROTL(v[3], 18));
+    h[1] = lx_pgs_mix((v[0] ^ LX_PGS_ROTL(v[2], 27)) + (v[1] ^ LX_PGS_ROTL(v[3], 41)) + LX_PGS_P3);
+}
+
+// create empty store
+int lx_pgstore_init(lx_pgstore_t *store, uint32_t pages)
+{
+    uint32_t buckets;
+
+    memset(store, 0, sizeof(*store));
+    for (buckets = 16; buckets < pages; buckets <<= 1);
+    store->mask = buckets - 1;
+    store->hash = (lx_spage_t **)calloc(buckets, sizeof(lx_spage_t *));
+    if (!store->hash)
+    {
+        return LX_MOD_ERR_MEM;
+    }
+    pthread_mutex_init(&store->lock, NULL);
+    return LX_MOD_OK;
+}
+
+// free all pages
+void lx_pgstore_done(lx_pgstore_t *store)
+{
+    lx_spage_t *e;
+    uint32_t i;
+
+    if (!store->hash)
+    {
+        return;
+    }
+    for (i = 0; i <= store->mask; i++)
+    {
+        while ((e = store->hash[i]) != NULL)
+        {
+            store->hash[i] = e->hnext;
+            free(e);
+        }
+    }
+    free(store->hash);
+    store->hash = NULL;
+    pthread_mutex_destroy(&store->lock);
+}
+
+// double the buckets, store stays as is if there is no memory
+static void lx_pgstore_grow(lx_pgstore_t *store)
+{
+    lx_spage_t **hash, *e;
+    uint32_t mask = store->mask * 2 + 1;
+    uint32_t i;
+
+    hash = (lx_spage_t **)calloc(mask + 1, sizeof(lx_spage_t *));
+    if (!hash)
+    {
+        return;
+    }
+    for (i = 0; i <= store->mask; i++)
+    {
+        while ((e = store->hash[i]) != NULL)
+        {
+            store->hash[i] = e->hnext;
+            e->hnext = hash[e->h[0] & mask];
+            hash[e->h[0] & mask] = e;
+        }
+    }
+    free(store->hash);
+    store->hash = hash;
+    store->mask = mask;
+}
+
+// shared copy of the page
+const uint8_t *lx_pgstore_put(lx_pgstore_t *store, const uint8_t *page)
+{
+    lx_spage_t *e, *n = NULL;
+    uint64_t h[2];
+
+    lx_pgs_hash(page, h);
+    for (;;)
+    {
+        pthread_mutex_lock(&store->lock);
+        for (e = store->hash[h[0] & store->mask]; e; e = e->hnext)
+        {
+            // contents are compared too, equal hashes alone do not merge pages
+            if ((e->h[0] == h[0]) && (e->h[1] == h[1]) && !memcmp(e->data, page, LX_PAGE_SIZE))
+            {
+                break;
+            }
+        }
+        if (e || n)
+        {
+            break;
+        }
+        // new page is copied with the store unlocked, then looked up again
+        pthread_mutex_unlock(&store->lock);
+        n = (lx_spage_t *)malloc(sizeof(lx_spage_t));
+        if (!n)
+        {
+            return NULL;
+        }
+        n->h[0] = h[0];
+        n->h[1] = h[1];
+        n->refs = 0;
+        memcpy(n->data, page, LX_PAGE_SIZE);
+    }
+    if (!e)
+    {
+        e = n;
+        n = NULL;
+        e->hnext = store->hash[h[0] & store->mask];
+        store->hash[h[0] & store->mask] = e;
+        store->pages++;
+        if (store->pages > store->mask + 1)
+        {
+            lx_pgstore_grow(store);
+        }
+    }
+    e->refs++;
+    store->refs++;
+    pthread_mutex_unlock(&store->lock);
+    // page was added by another thread meanwhile
+    free(n);
+    return e->data;
+}
+
+// unpack page of the module into the store
+const uint8_t *lx_pgstore_unpack(lx_pgstore_t *store, const lx_module_t *mod, uint32_t page)
+{
+    uint8_t buf[LX_PAGE_SIZE];
+
+    if (lx_unpack_page(mod, page, buf) != LX_MOD_OK)
+    {
+        return NULL;
+    }
+    return lx_pgstore_put(store, buf);
+}
+
+// all pages of the module
+int lx_pgstore_module(lx_pgstore_t *store, const lx_module_t *mod, const uint8_t **pages)
+{
+    uint8_t buf[LX_PAGE_SIZE];
+    uint32_t i;
+    int rc;
+
+    for (i = 0; i < mod->hdr->mpages; i++)
+    {
+        rc = lx_unpack_page(mod, i, buf);
+        if (rc == LX_MOD_OK)
+        {
+            pages[i] = lx_pgstore_put(store, buf);
+            rc = pages[i] ? LX_MOD_OK : LX_MOD_ERR_MEM;
+        }
+        if (rc != LX_MOD_OK)
+        {
+            while (i > 0)
+            {
+                lx_pgstore_release(store, pages[--i]);
+            }
+            return rc;
+        }
+    }
+    return LX_MOD_OK;
+}
+
+// one more reference to the page
+void lx_pgstore_addref(lx_pgstore_t *store, const uint8_t *data)
+{
+    lx_spage_t *e = (lx_spage_t *)(data - offsetof(lx_spage_t, data));
+
+    pthread_mutex_lock(&store->lock);
+    e->refs++;
+    store->refs++;
+    pthread_mutex_unlock(&store->lock);
+}
+
+// end of the page use
+void lx_pgstore_release(lx_pgstore_t *store, const uint8_t *data)
+{
+    lx_spage_t *e = (lx_spage_t *)(data - offsetof(lx_spage_t, data));
+    lx_spage_t **p;
+
+    pthread_mutex_lock(&store->lock);
+    store->refs--;
+    if (--e->refs)
+    {
+        pthread_mutex_unlock(&store->lock);
+        return;
+    }
+    for (p = &store->hash[e->h[0] & store->mask]; *p != e; p = &(*p)->hnext);
+    *p = e->hnext;
+    store->pages--;
+    pthread_mutex_unlock(&store->lock);
+    free(e);
+}
+
+// current counters
+void lx_pgstore_stats(lx_pgstore_t *store, lx_pgstore_stats_t *stats)
+{
+    pthread_mutex_lock(&store->lock);
+    stats->pages = store->pages;
+    stats->refs = store->refs;
+    stats->resident = (uint64_t)store->pages * sizeof(lx_spage_t) + (uint64_t)(store->mask + 1) * sizeof(lx_spage_t *);
+    pthread_mutex_unlock(&store->lock);
+    stats->bytes = stats->refs * LX_PAGE_SIZE;
+    stats->ratio = stats->pages ? (double)stats->refs / stats->pages : 0;
+}
+
+#endif // LX_PGSTORE_IMPLEMENTATION
+
+#endif // __H_LX_PGSTORE__
@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: MIT
+#ifndef __H_LX_PIPE__
+#define __H_LX_PIPE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include "lxmodule.h"
+
+// Pipelined loading of LX pages on the host (pthreads).
+// Module file is not in memory: headers and tables are read once, then pages
+// go through three stages at once, reading of page N+1, unpacking of page N
+// and writing of page N-1. Stages pass pages over a fixed ring of buffers, so
+// nothing is allocated per page, and reading runs up to the ring size ahead, so
+// slow media keep the decoder busy as long as they keep up on average. File is
+// read through a callback, e.g. pread, or SecHlpReadL wrapped by the caller.
+// Requires LX_MODULE_IMPLEMENTATION and LX_UNPACK_IMPLEMENTATION.
+
+#define LX_PIPE_DEPTH                  8       // pages in the ring
+#define LX_PIPE_MAX_HEAD               0x1000000  // headers and tables up to the data pages
+
+// read size bytes at offset of the file, returns LX_MOD_OK or error
+typedef int (*lx_read_t)(void *ctx, uint32_t offset, uint8_t *buf, uint32_t size);
+// take unpacked page (0-based object page table index), LX_PAGE_SIZE bytes
+// valid until return, returns LX_MOD_OK or error
+typedef int (*lx_write_t)(void *ctx, uint32_t page, const uint8_t *data);
+
+// page in the ring
+typedef struct lx_pslot_s
+{
+    uint8_t            *src;     // packed page data
+    uint8_t             dst[LX_PAGE_SIZE];
+} lx_pslot_t;
+
+typedef struct lx_pipe_s
+{
+    lx_module_t         mod;     // headers and tables, pages are not in image
+    uint8_t            *head;    // file up to the data pages
+    lx_read_t           read;
+    void               *ctx;
+    // stages state, under the lock
+    pthread_mutex_t     lock;
+    pthread_cond_t      moved;   // some stage is done with a page
+    lx_pslot_t         *slot;
+    uint32_t            read_next;     // next page of each stage
+    uint32_t            decode_next;
+    uint32_t            write_next;
+    int                 rc;      // first error of any stage
+    uint64_t            decode_waits;  // decoder waited for input
+    uint64_t            read_waits;    // reader waited for a free buffer
+} lx_pipe_t;
+
+// read headers and tables of the module through read callback
+int lx_pipe_open(lx_pipe_t *pipe, lx_read_t read, void *ctx);
+// unpack all pages in the object page table order, each goes to write callback.
+// Returns LX_MOD_OK or the first error
+int lx_pipe_run(lx_pipe_t *pipe, lx_write_t write, void *ctx);
+// free the module tables
+void lx_pipe_close(lx_pipe_t *pipe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef LX_PIPE_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+// read headers and tables of the module
+int lx_pipe_open(lx_pipe_t *pipe, lx_read_t read, void *ctx)
+{
+    uint8_t stub[LX_MZ_LFANEW + 4];
+    lx_hdr_t hdr;
+    uint32_t lx_off = 0;
+    int rc;
+
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->read = read;
+    pipe->ctx = ctx;
+    // DOS stub and LX header first, they tell where the data pages start
+    rc = read(ctx, 0, stub, sizeof(stub));
+    if (rc != LX_MOD_OK)
+    {
+        return rc;
+    }
+    if ((stub[0] == 'M') && (stub[1] == 'Z'))
+    {
+        lx_off = stub[LX_MZ_LFANEW] | ((uint32_t)stub[LX_MZ_LFANEW + 1] << 8) |
+                 ((uint32_t)stub[LX_MZ_LFANEW + 2] << 16) | ((uint32_t)stub[LX_MZ_LFANEW + 3] << 24);
+    }
+    if (lx_off > LX_PIPE_MAX_HEAD)
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    rc = read(ctx, lx_off, (uint8_t *)&hdr, sizeof(hdr));
+    if (rc != LX_MOD_OK)
+    {
+        return rc;
+    }
+    if ((hdr.datapage < lx_off + sizeof(hdr)) || (hdr.datapage > LX_PIPE_MAX_HEAD))
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    pipe->head = (uint8_t *)malloc(hdr.datapage);
+    if (!pipe->head)
+    {
+        return LX_MOD_ERR_MEM;
+    }
+    rc = read(ctx, 0, pipe->head, hdr.datapage);
+    if (rc == LX_MOD_OK)
+    {
+        // object and page tables must be before the data pages
+        rc = lx_module_open(&pipe->mod, pipe->head, hdr.datapage);
+    }
+    if (rc != LX_MOD_OK)
+    {
+        lx_pipe_close(pipe);
+    }
+    return rc;
+}
+
+// free the module tables
+void lx_pipe_close(lx_pipe_t *pipe)
+{
+    free(pipe->head);
+    pipe->head = NULL;
+}
+
+// page has data in the file
+static int lx_pipe_has_data(const lx_map_t *map)
+{
+    return ((map->flags == LX_PAGE_VALID) || (map->flags == LX_PAGE_ITERDATA) || (map->flags == LX_PAGE_ITERDATA2)) && map->size;
+}
+
+// end of a stage with a page, rc of it is kept if it is the first error
+static void lx_pipe_done(lx_pipe_t *pipe, uint32_t *next, int rc)
+{
+    pthread_mutex_lock(&pipe->lock);
+    (*next)++;
+    if ((rc != LX_MOD_OK) && (pipe->rc == LX_MOD_OK))
+    {
+        pipe->rc = rc;
+    }
+    pthread_cond_broadcast(&pipe->moved);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+// read pages ahead while there are free buffers
+static void *lx_pipe_reader(void *arg)
+{
+    lx_pipe_t *pipe = (lx_pipe_t *)arg;
+    const lx_map_t *map;
+    uint64_t offset;
+    uint32_t page;
+    int rc;
+
+    for (page = 0; page < pipe->mod.hdr->mpages; page++)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        if ((page - pipe->write_next >= LX_PIPE_DEPTH) && (pipe->rc == LX_MOD_OK))
+        {
+            pipe->read_waits++;
+            // buffer of the page is free once the page LX_PIPE_DEPTH back is written
+            while ((page - pipe->write_next >= LX_PIPE_DEPTH) && (pipe->rc == LX_MOD_OK))
+            {
+                pthread_cond_wait(&pipe->moved, &pipe->lock);
+            }
+        }
+        rc = pipe->rc;
+        pthread_mutex_unlock(&pipe->lock);
+        if (rc != LX_MOD_OK)
+        {
+            break;
+        }
+        map = &pipe->mod.map[page];
+        if (lx_pipe_has_data(map))
+        {
+            offset = (uint64_t)pipe->mod.hdr->datapage + ((uint64_t)map->offset << pipe->mod.hdr->pageshift);
+            rc = (offset + map->size > 0xFFFFFFFFULL) ? LX_MOD_ERR_FORMAT :
+                 pipe->read(pipe->ctx, (uint32_t)offset, pipe->slot[page % LX_PIPE_DEPTH].src, map->size);
+        }
+        lx_pipe_done(pipe, &pipe->read_next, rc);
+    }
+    return NULL;
+}
+
+// unpack pages as they are read
+static void *lx_pipe_decoder(void *arg)
+{
+    lx_pipe_t *pipe = (lx_pipe_t *)arg;
+    lx_pslot_t *slot;
+    uint32_t page;
+    int rc;
+
+    for (page = 0; page < pipe->mod.hdr->mpages; page++)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        if ((page >= pipe->read_next) && (pipe->rc == LX_MOD_OK))
+        {
+            pipe->decode_waits++;
+            while ((page >= pipe->read_next) && (pipe->rc == LX_MOD_OK))
+            {
+                pthread_cond_wait(&pipe->moved, &pipe->lock);
+            }
+        }
+        rc = pipe->rc;
+        pthread_mutex_unlock(&pipe->lock);
+        if (rc != LX_MOD_OK)
+        {
+            break;
+        }
+        slot = &pipe->slot[page % LX_PIPE_DEPTH];
+        rc = lx_unpack_data(&pipe->mod.map[page], slot->src, slot->dst, LX_PAGE_SIZE);
+        lx_pipe_done(pipe, &pipe->decode_next, rc);
+    }
+    return NULL;
+}
+
+// unpack all pages, calling thread writes them
+int lx_pipe_run(lx_pipe_t *pipe, lx_write_t write, void *ctx)
+{
+    pthread_t reader, decoder;
+    uint32_t max_size = 1, page, i;
+    int started = 0;
+    uint8_t *src;
+    int rc;
+
+    if (!pipe->head)
+    {
+        return LX_MOD_ERR_FORMAT;
+    }
+    // buffers for the biggest page of the module, allocated once
+    for (i = 0; i < pipe->mod.hdr->mpages; i++)
+    {
+        if (lx_pipe_has_data(&pipe->mod.map[i]) && (pipe->mod.map[i].size > max_size))
+        {
+            max_size = pipe->mod.map[i].size;
+        }
+    }
+    pipe->slot = (lx_pslot_t *)malloc(LX_PIPE_DEPTH * sizeof(lx_pslot_t));
+    src = (uint8_t *)malloc(LX_PIPE_DEPTH * max_size);
+    if (!pipe->slot || !src)
+    {
+        free(pipe->slot);
+        free(src);
+        pipe->slot = NULL;
+        return LX_MOD_ERR_MEM;
+    }
+    for (i = 0; i < LX_PIPE_DEPTH; i++)
+    {
+        pipe->slot[i].src = src + i * max_size;
+    }
+    pipe->read_next = pipe->decode_next = pipe->write_next = 0;
+    pipe->rc = LX_MOD_OK;
+    pipe->decode_waits = pipe->read_waits = 0;
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->moved, NULL);
+    rc = LX_MOD_OK;
+    if (!pthread_create(&reader, NULL, lx_pipe_reader, pipe))
+    {
+        started |= 1;
+        if (!pthread_create(&decoder, NULL, lx_pipe_decoder, pipe))
+        {
+            started |= 2;
+        }
+    }
+    if (started != 3)
+    {
+        // stops the stage already started
+        rc = LX_MOD_ERR_MEM;
+        pthread_mutex_lock(&pipe->lock);
+        pipe->rc = rc;
+        pthread_cond_broadcast(&pipe->moved);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+    for (page = 0; (rc == LX_MOD_OK) && (page < pipe->mod.hdr->mpages); page++)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        while ((page >= pipe->decode_next) && (pipe->rc == LX_MOD_OK))
+        {
+            pthread_cond_wait(&pipe->moved, &pipe->lock);
+        }
+        rc = pipe->rc;
+        pthread_mutex_unlock(&pipe->lock);
+        if (rc != LX_MOD_OK)
+        {
+            break;
+        }
+        rc = write(ctx, page, pipe->slot[page % LX_PIPE_DEPTH].dst);
+        lx_pipe_done(pipe, &pipe->write_next, rc);
+    }
+    if (started & 2)
+    {
+        pthread_join(decoder, NULL);
+    }
+    if (started & 1)
+    {
+        pthread_join(reader, NULL);
+    }
+    rc = pipe->rc;
+    pthread_cond_destroy(&pipe->moved);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe->slot[0].src);
+    free(pipe->slot);
+    pipe->slot = NULL;
+    return rc;
+}
+
+#endif // LX_PIPE_IMPLEMENTATION
+
+#endif // __H_LX_PIPE__
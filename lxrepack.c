@@ -0,0 +1,410 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define LX_UNPACK_IMPLEMENTATION
+#include "lxunpack.h"
+#define LX_PACK_IMPLEMENTATION
+#include "lxpack.h"
+#define LX_MODULE_IMPLEMENTATION
+#include "lxmodule.h"
+
+// Repack all pages of an LX file with EXEPACK:2 on all CPUs.
+// Each page is unpacked, its trailing zeroes are dropped as the loader zeroes
+// the rest of the page anyway, then it is packed and the result is unpacked
+// again with lx_unpack2 to check it. Page keeps its original data when that is
+// not bigger. Data pages are written one after another with pageshift 0, the
+// file parts after them (non-resident names, debug info) are moved behind and
+// header offsets of all tables there are adjusted. Files with any table among
+// the data pages are rejected.
+
+// tables addressed from the header, must not be among the data pages
+typedef struct table_s
+{
+    size_t          field;       // offset of the table offset in lx_hdr_t
+    int             file_rel;    // table offset is file relative, not LX header relative
+} table_t;
+
+static const table_t tables[] =
+{
+    { offsetof(lx_hdr_t, objtab),    0 },
+    { offsetof(lx_hdr_t, itermap),   1 },
+    { offsetof(lx_hdr_t, rsrctab),   0 },
+    { offsetof(lx_hdr_t, restab),    0 },
+    { offsetof(lx_hdr_t, enttab),    0 },
+    { offsetof(lx_hdr_t, dirtab),    0 },
+    { offsetof(lx_hdr_t, fpagetab),  0 },
+    { offsetof(lx_hdr_t, frectab),   0 },
+    { offsetof(lx_hdr_t, impmod),    0 },
+    { offsetof(lx_hdr_t, impproc),   0 },
+    { offsetof(lx_hdr_t, pagesum),   0 },
+    { offsetof(lx_hdr_t, nrestab),   1 },
+    { offsetof(lx_hdr_t, debuginfo), 1 },
+};
+
+#define TABLES                       (sizeof(tables) / sizeof(tables[0]))
+#define TABLE_OFFSET(hdr, i)         (*(uint32_t *)((uint8_t *)(hdr) + tables[i].field))
+
+// result of one page
+typedef struct rpage_s
+{
+    const uint8_t  *src;         // data to write, original or packed
+    uint16_t        size;
+    uint16_t        flags;       // LX_PAGE_xxx
+    int             packed;      // repacked to EXEPACK:2
+    int             rc;          // LX_MOD_xxx
+} rpage_t;
+
+// work shared by the workers
+typedef struct repack_s
+{
+    const lx_module_t  *mod;
+    rpage_t            *page;
+    uint8_t            *out;     // LX_PAGE_SIZE bytes of packed data per page
+    int                 level;
+    atomic_uint         next;    // next page to take
+    atomic_uint         failed;  // pages packed wrong, kept original
+} repack_t;
+
+static uint8_t *load_file(const char *name, uint32_t *size)
+{
+    uint8_t *data = NULL;
+    FILE *f;
+    long len;
+
+    f = fopen(name, "rb");
+    if (!f)
+    {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len > 0)
+    {
+        data = (uint8_t *)malloc(len);
+    }
+    if (data && (len != (long)fread(data, 1, len, f)))
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = (uint32_t)len;
+    return data;
+}
+
+// repack one page
+static void repack_page(repack_t *rp, uint32_t i)
+{
+    const lx_map_t *map = &rp->mod->map[i];
+    rpage_t *p = &rp->page[i];
+    uint8_t page[LX_PAGE_SIZE];
+    uint8_t check[LX_PAGE_SIZE];
+    uint8_t *dst = rp->out + (size_t)i * LX_PAGE_SIZE;
+    int16_t len, size;
+
+    p->src = lx_page_data(rp->mod, i);
+    p->size = map->size;
+    p->flags = map->flags;
+    p->packed = 0;
+    p->rc = LX_MOD_OK;
+    if ((map->flags != LX_PAGE_VALID) && (map->flags != LX_PAGE_ITERDATA) && (map->flags != LX_PAGE_ITERDATA2))
+    {
+        // nothing to pack in zeroed, invalid and range pages
+        p->src = NULL;
+        return;
+    }
+    p->rc = lx_unpack_page(rp->mod, i, page);
+    if (p->rc != LX_MOD_OK)
+    {
+        return;
+    }
+    for (len = LX_PAGE_SIZE; (len > 0) && !page[len - 1]; len--);
+    if (!len)
+    {
+        // page of zeroes needs no data
+        p->src = NULL;
+        p->size = 0;
+        p->flags = LX_PAGE_ZEROED;
+        p->packed = 1;
+        return;
+    }
+    // must be smaller than the original to be used
+    size = lx_pack2(dst, (int16_t)(map->size - 1), page, len, rp->level);
+    if ((size < 0) || (size >= map->size))
+    {
+        return;
+    }
+    if ((lx_unpack2(check, dst, size) != len) || memcmp(check, page, len))
+    {
+        atomic_fetch_add(&rp->failed, 1);
+        return;
+    }
+    p->src = dst;
+    p->size = size;
+    p->flags = LX_PAGE_ITERDATA2;
+    p->packed = 1;
+}
+
+static void *repack_worker(void *arg)
+{
+    repack_t *rp = (repack_t *)arg;
+    uint32_t i;
+
+    while ((i = atomic_fetch_add(&rp->next, 1)) < rp->mod->hdr->mpages)
+    {
+        repack_page(rp, i);
+    }
+    return NULL;
+}
+
+// repack all pages with given number of threads (0 - one per CPU)
+static int repack_pages(repack_t *rp, uint32_t threads)
+{
+    pthread_t *tid;
+    uint32_t i, started;
+    long cpus;
+
+    if (!threads)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+    if (threads > rp->mod->hdr->mpages)
+    {
+        threads = rp->mod->hdr->mpages ? rp->mod->hdr->mpages : 1;
+    }
+    tid = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if (!tid)
+    {
+        return LX_MOD_ERR_MEM;
+    }
+    // calling thread works too, also when no threads can be created
+    for (started = 0; started < threads - 1; started++)
+    {
+        if (pthread_create(&tid[started], NULL, repack_worker, rp))
+        {
+            break;
+        }
+    }
+    repack_worker(rp);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(tid[i], NULL);
+    }
+    free(tid);
+    for (i = 0; i < rp->mod->hdr->mpages; i++)
+    {
+        if (rp->page[i].rc != LX_MOD_OK)
+        {
+            return rp->page[i].rc;
+        }
+    }
+    return LX_MOD_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    lx_module_t mod;
+    repack_t rp;
+    lx_hdr_t *hdr;
+    lx_map_t *map;
+    uint8_t *image = NULL, *res = NULL;
+    uint32_t size = 0, lx_off, start, end, pos, delta, table, i;
+    uint32_t threads = 0, packed = 0, out_size;
+    uint64_t page_end;
+    int arg = 1, rc = 0;
+    struct timespec t0, t1;
+    FILE *fo;
+
+    memset(&rp, 0, sizeof(rp));
+    rp.level = LX_PACK_DEFAULT;
+    for (; (arg + 1 < argc) && (argv[arg][0] == '-'); arg += 2)
+    {
+        if (!strcmp(argv[arg], "-l"))
+        {
+            rp.level = atoi(argv[arg + 1]);
+        }
+        else if (!strcmp(argv[arg], "-t"))
+        {
+            threads = atoi(argv[arg + 1]);
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (argc - arg != 2)
+    {
+        fprintf(stdout, "USAGE: %s [-l <level: 1, 2 or 3>] [-t <threads>] <input LX file> <output LX file>\n", argv[0]);
+        return 1;
+    }
+    image = load_file(argv[arg], &size);
+    if (!image)
+    {
+        fprintf(stderr, "Error to read file %s\n", argv[arg]);
+        return 2;
+    }
+    if (lx_module_open(&mod, image, size) != LX_MOD_OK)
+    {
+        fprintf(stderr, "File %s is not an LX module\n", argv[arg]);
+        rc = 4;
+        goto end;
+    }
+    lx_off = (uint32_t)((const uint8_t *)mod.hdr - image);
+    // start and end of the data pages
+    start = UINT32_MAX;
+    end = mod.hdr->datapage;
+    for (i = 0; i < mod.hdr->mpages; i++)
+    {
+        if ( ((mod.map[i].flags == LX_PAGE_VALID) || (mod.map[i].flags == LX_PAGE_ITERDATA) ||
+              (mod.map[i].flags == LX_PAGE_ITERDATA2)) && mod.map[i].size
+           )
+        {
+            page_end = (uint64_t)mod.hdr->datapage + ((uint64_t)mod.map[i].offset << mod.hdr->pageshift) + mod.map[i].size;
+            if (page_end > size)
+            {
+                fprintf(stderr, "Page %u is out of file\n", i + 1);
+                rc = 4;
+                goto end;
+            }
+            if (page_end - mod.map[i].size < start)
+            {
+                start = (uint32_t)(page_end - mod.map[i].size);
+            }
+            if (page_end > end)
+            {
+                end = (uint32_t)page_end;
+            }
+        }
+    }
+    // only the data pages are moved, all tables must be before or after them
+    if ( (mod.hdr->datapage > size) ||
+         (lx_off + mod.hdr->objmap + mod.hdr->mpages * sizeof(lx_map_t) > mod.hdr->datapage)
+       )
+    {
+        fprintf(stderr, "Unsupported layout of file %s\n", argv[arg]);
+        rc = 4;
+        goto end;
+    }
+    for (i = 0; i < TABLES; i++)
+    {
+        table = TABLE_OFFSET(mod.hdr, i);
+        if (table && !tables[i].file_rel)
+        {
+            table += lx_off;
+        }
+        // empty tables may point to the end of the loader section, data of the first page
+        if ( table && (table >= mod.hdr->datapage) && (table < end) &&
+             ((table != mod.hdr->datapage) || (start != mod.hdr->datapage))
+           )
+        {
+            fprintf(stderr, "Unsupported layout of file %s\n", argv[arg]);
+            rc = 4;
+            goto end;
+        }
+    }
+    rp.mod = &mod;
+    rp.page = (rpage_t *)calloc(mod.hdr->mpages ? mod.hdr->mpages : 1, sizeof(rpage_t));
+    rp.out = (uint8_t *)malloc(mod.hdr->mpages ? (size_t)mod.hdr->mpages * LX_PAGE_SIZE : 1);
+    if (!rp.page || !rp.out)
+    {
+        fprintf(stderr, "Not enough memory\n");
+        rc = 4;
+        goto end;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = repack_pages(&rp, threads);
+    if (rc != LX_MOD_OK)
+    {
+        fprintf(stderr, "Unpacking of module failed with %d\n", rc);
+        rc = 4;
+        goto end;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    // new file: all before the pages, pages, all after them
+    for (i = 0, out_size = mod.hdr->datapage; i < mod.hdr->mpages; i++)
+    {
+        out_size += rp.page[i].src ? rp.page[i].size : 0;
+        packed += rp.page[i].packed;
+    }
+    out_size += size - end;
+    res = (uint8_t *)malloc(out_size);
+    if (!res)
+    {
+        fprintf(stderr, "Not enough memory\n");
+        rc = 4;
+        goto end;
+    }
+    memcpy(res, image, mod.hdr->datapage);
+    hdr = (lx_hdr_t *)(res + lx_off);
+    map = (lx_map_t *)(res + lx_off + hdr->objmap);
+    for (i = 0, pos = hdr->datapage; i < hdr->mpages; i++)
+    {
+        map[i].offset = 0;
+        map[i].size = 0;
+        map[i].flags = rp.page[i].flags;
+        if (rp.page[i].src)
+        {
+            map[i].offset = pos - hdr->datapage;
+            map[i].size = rp.page[i].size;
+            memcpy(res + pos, rp.page[i].src, rp.page[i].size);
+            pos += rp.page[i].size;
+        }
+        else if (map[i].flags == mod.map[i].flags)
+        {
+            // pages without data keep their entries
+            map[i].offset = mod.map[i].offset;
+            map[i].size = mod.map[i].size;
+        }
+    }
+    memcpy(res + pos, image + end, size - end);
+    hdr->pageshift = 0;
+    delta = pos - end;
+    for (i = 0; i < TABLES; i++)
+    {
+        table = TABLE_OFFSET(hdr, i);
+        if (table && !tables[i].file_rel)
+        {
+            table += lx_off;
+        }
+        if (table && (table >= end))
+        {
+            TABLE_OFFSET(hdr, i) += delta;
+        }
+    }
+    fprintf(stdout, "Repacked %u of %u pages in %.3f s, %u -> %u bytes", packed, hdr->mpages,
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, size, out_size);
+    if (atomic_load(&rp.failed))
+    {
+        fprintf(stdout, ", %u pages failed to pack and kept", atomic_load(&rp.failed));
+    }
+    fprintf(stdout, "\n");
+    fo = fopen(argv[arg + 1], "wb");
+    if (!fo)
+    {
+        fprintf(stderr, "Error to create file %s\n", argv[arg + 1]);
+        rc = 3;
+        goto end;
+    }
+    if ((out_size != fwrite(res, 1, out_size, fo)) | fclose(fo))
+    {
+        fprintf(stderr, "Error to write file %s\n", argv[arg + 1]);
+        rc = 5;
+        goto end;
+    }
+
+end:
+    free(image);
+    free(res);
+    free(rp.page);
+    free(rp.out);
+    return rc;
+}
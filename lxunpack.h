@@ -15,235 +15,758 @@ extern "C" {
 int16_t lx_unpack1(uint8_t *dst, uint8_t *src, int16_t src_size);
 // unpack one page, packed with EXEPACK:2 
 int16_t lx_unpack2(uint8_t *dst, uint8_t *src, int16_t src_size);
+// unpack one page into dst_size bytes of dst (at most LX_PAGE_SIZE), e.g. right
+// into its place within a bigger object buffer. Nothing past dst_size is written,
+// page unpacking to more is bad data. Otherwise same as lx_unpack1/lx_unpack2
+int16_t lx_unpack1_span(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size);
+int16_t lx_unpack2_span(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size);
+// unpacked size of the page packed with EXEPACK:1 or EXEPACK:2, or -1.
+// Same checks as of lx_unpack1/lx_unpack2, but nothing is unpacked
+int16_t lx_unpack1_size(const uint8_t *src, int16_t src_size);
+int16_t lx_unpack2_size(const uint8_t *src, int16_t src_size);
+// unpack EXEPACK:2 page known to be good, e.g. checked once with lx_unpack2_size,
+// same result as of lx_unpack2 but without any bounds checks
+int16_t lx_unpack2_unchecked(uint8_t *dst, const uint8_t *src, int16_t src_size);
+
+// resumable EXEPACK:2 decoder, packed page may come in chunks of any size.
+// Decoding pauses at the end of a chunk, even within a token, and goes on
+// with the next one, so no buffer for the whole packed page is needed
+typedef struct lx_unpack2_state_s
+{
+    uint8_t    *dst;             // next output byte
+    int16_t     dst_size;        // room left in the output page
+    uint8_t     state;           // what is expected from the input next
+    uint8_t     tok_len;         // token header bytes collected so far
+    uint8_t     tok[3];          // token header
+    uint8_t     lit;             // literal bytes still to come
+    uint8_t     string;          // repeated string follows the literals
+    uint8_t     len;             // its length
+    uint16_t    off;             // repeated string offset
+} lx_unpack2_state_t;
+
+// start unpacking of one page into dst
+void lx_unpack2_init(lx_unpack2_state_t *st, uint8_t *dst);
+// unpack next chunk of packed data,
+// returns 0 - more data expected, 1 - end marker found, -1 - bad data
+int16_t lx_unpack2_feed(lx_unpack2_state_t *st, const uint8_t *src, int16_t src_size);
+// end of packed data, returns unpacked size or -1, same as lx_unpack2.
+// Packed data ending within a token is bad data
+int16_t lx_unpack2_finish(lx_unpack2_state_t *st);
 
 #ifdef __cplusplus
 }
 #endif
 
-#ifdef LX_UNPACK_IMPLEMENTATION
+// copy kernels and token table, shared with C++ templates of lxunpack.hpp
+#if defined(LX_UNPACK_IMPLEMENTATION) || (defined(__cplusplus) && defined(LX_UNPACK_TEMPLATES))
+
+// SSE2/AVX2 copy kernels are used when the compiler targets them,
+// define LX_UNPACK_NO_SIMD to keep vector registers untouched (e.g. at Ring0)
+#ifndef LX_UNPACK_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define LX_UNPACK_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define LX_UNPACK_AVX2
+#include <immintrin.h>
+#endif
+#endif // LX_UNPACK_NO_SIMD
+
+// unaligned word access, output page has no alignment guarantees
+#if defined(__GNUC__) || defined(__clang__)
+typedef uint32_t __attribute__((__may_alias__, __aligned__(1))) lx_u32u_t;
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) lx_u64u_t;
+#else
+typedef uint32_t lx_u32u_t;
+typedef uint64_t lx_u64u_t;
+#endif
 
-// simple byte-by-byte copy (memcpy-like)
-static void bcopy(uint8_t *dst, uint8_t *src, uint16_t len)
+// distance value for copies between non-overlapping buffers
+#define LX_NO_OVERLAP                  0xFFFF
+
+// forward copy (memcpy-like), moving as wide words as possible.
+// src may lie behind dst within the same buffer, dist = dst - src then:
+// words never span more than dist bytes, so overlapped data is replicated
+// exactly as by the byte-by-byte copy
+static void lx_copy(uint8_t *dst, const uint8_t *src, uint16_t len, uint16_t dist)
 {
+#ifdef LX_UNPACK_AVX2
+    if ((len >= 32) && (dist >= 32))
+    {
+        for (; len > 32; len -= 32, dst += 32, src += 32)
+        {
+            _mm256_storeu_si256((__m256i *)dst, _mm256_loadu_si256((const __m256i *)src));
+        }
+        // last word may overlap the bytes just written, that's fine
+        _mm256_storeu_si256((__m256i *)(dst + len - 32), _mm256_loadu_si256((const __m256i *)(src + len - 32)));
+        return;
+    }
+#endif
+#ifdef LX_UNPACK_SSE2
+    if ((len >= 16) && (dist >= 16))
+    {
+        for (; len > 16; len -= 16, dst += 16, src += 16)
+        {
+            _mm_storeu_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+        }
+        _mm_storeu_si128((__m128i *)(dst + len - 16), _mm_loadu_si128((const __m128i *)(src + len - 16)));
+        return;
+    }
+#endif
+    if ((len >= 8) && (dist >= 8))
+    {
+        for (; len > 8; len -= 8, dst += 8, src += 8)
+        {
+            *(lx_u64u_t *)dst = *(const lx_u64u_t *)src;
+        }
+        *(lx_u64u_t *)(dst + len - 8) = *(const lx_u64u_t *)(src + len - 8);
+        return;
+    }
+    if ((len >= 4) && (dist >= 4))
+    {
+        for (; len > 4; len -= 4, dst += 4, src += 4)
+        {
+            *(lx_u32u_t *)dst = *(const lx_u32u_t *)src;
+        }
+        *(lx_u32u_t *)(dst + len - 4) = *(const lx_u32u_t *)(src + len - 4);
+        return;
+    }
     for (; len > 0; len--)
     {
         *dst++ = *src++;
     }
 }
 
-// simple byte fill (memset-like)
-static void bfill(uint8_t *dst, uint8_t val, uint16_t len)
+// byte fill (memset-like)
+static void lx_fill(uint8_t *dst, uint8_t val, uint16_t len)
 {
+    uint64_t pat;
+
+#ifdef LX_UNPACK_SSE2
+    if (len >= 16)
+    {
+        __m128i v = _mm_set1_epi8((char)val);
+
+        for (; len > 16; len -= 16, dst += 16)
+        {
+            _mm_storeu_si128((__m128i *)dst, v);
+        }
+        _mm_storeu_si128((__m128i *)(dst + len - 16), v);
+        return;
+    }
+#endif
+    if (len >= 8)
+    {
+        pat = val * 0x0101010101010101ULL;
+        for (; len > 8; len -= 8, dst += 8)
+        {
+            *(lx_u64u_t *)dst = pat;
+        }
+        *(lx_u64u_t *)(dst + len - 8) = pat;
+        return;
+    }
     for (; len > 0; len--)
     {
         *dst++ = val;
     }
 }
 
+// copy len bytes from off bytes back in the output,
+// result is the same as of the byte-by-byte copy for any off and len
+static void lx_copy_back(uint8_t *dst, uint16_t off, uint16_t len)
+{
+    uint16_t step;
+    uint16_t head;
+
+    if (off >= len)
+    {
+        // no overlap at all
+        lx_copy(dst, dst - off, len, LX_NO_OVERLAP);
+    }
+    else if (off == 1)
+    {
+        // last byte repeated
+        lx_fill(dst, dst[-1], len);
+    }
+    else if (off >= 8)
+    {
+        // words of up to off bytes never read own output
+        lx_copy(dst, dst - off, len, off);
+    }
+    else if (off)
+    {
+        // short pattern: output is periodic with period off, so it can be
+        // copied from any multiple of off back. Write the first bytes one
+        // by one, until pattern multiple of at least 8 bytes is available
+        for (step = off; step < 8; step += off);
+        head = step - off;
+        if (head > len)
+        {
+            head = len;
+        }
+        len -= head;
+        for (; head > 0; head--, dst++)
+        {
+            *dst = dst[-(int)off];
+        }
+        if (len)
+        {
+            lx_copy(dst, dst - step, len, step);
+        }
+    }
+    // off == 0 copies bytes onto itself, nothing to do
+}
+
+// repeat the first len bytes at dst up to total bytes (EXEPACK:1 record),
+// each copy takes all bytes written so far, so copies double in size
+static void lx_repeat(uint8_t *dst, uint16_t len, uint16_t total)
+{
+    uint16_t done;
+
+    for (done = len; done < total; done += done)
+    {
+        lx_copy(dst + done, dst, (total - done < done) ? total - done : done, LX_NO_OVERLAP);
+    }
+}
+
+// EXEPACK:2 token descriptor, all fields a token header carries in its first byte.
+// Token is a header of hdr bytes, nr literal bytes and a string of len bytes
+// copied from off bytes back in the output
+typedef struct lx_tok2_s
+{
+    uint8_t     hdr;             // header size, 0 - iterated bytes or end marker
+    uint8_t     nr;              // literal bytes count
+    uint8_t     late;            // literals not checked against the input size (long token)
+    int8_t      min;             // least input size allowed after the header and literals
+    uint8_t     len;             // string length, low bits of it for the long token
+    uint8_t     lmask;           // high length bits in the second header byte
+    uint8_t     oidx;            // offset bits are in the 16-bit word at this header byte
+    uint8_t     oshift;          // offset position in that word
+    uint16_t    omask;           // and its size
+} lx_tok2_t;
+
+// descriptor of the token with the first byte b, switch(b & 3) is done here
+// at compile time: 0 - literals, 1 - short string, 2 - mid string, 3 - long string
+#define LX_TOK2(b) \
+    { \
+        (uint8_t)(!(b) ? 0 : ((b) & 3) == 0 ? 1 : ((b) & 3) == 3 ? 3 : 2), \
+        (uint8_t)(((b) & 3) == 0 ? (b) >> 2 : ((b) & 3) == 1 ? ((b) >> 2) & 3 : ((b) & 3) == 3 ? ((b) >> 2) & 15 : 0), \
+        (uint8_t)(((b) & 3) == 3 ? ((b) >> 2) & 15 : 0), \
+        (int8_t)(((b) & 3) == 2 ? -1 : 0), \
+        (uint8_t)(((b) & 3) == 0 ? 0 : ((b) & 3) == 1 ? (((b) >> 4) & 7) + 3 : ((b) & 3) == 2 ? (((b) >> 2) & 3) + 3 : (b) >> 6), \
+        (uint8_t)(((b) & 3) == 3 ? 0x0F : 0), \
+        (uint8_t)(((b) & 3) == 3 ? 1 : 0), \
+        (uint8_t)(((b) & 3) == 1 ? 7 : 4), \
+        (uint16_t)(((b) & 3) == 0 ? 0 : ((b) & 3) == 1 ? 0x1FF : 0xFFF) \
+    }
+#define LX_TOK2_4(b)                   LX_TOK2(b), LX_TOK2((b) + 1), LX_TOK2((b) + 2), LX_TOK2((b) + 3)
+#define LX_TOK2_16(b)                  LX_TOK2_4(b), LX_TOK2_4((b) + 4), LX_TOK2_4((b) + 8), LX_TOK2_4((b) + 12)
+#define LX_TOK2_64(b)                  LX_TOK2_16(b), LX_TOK2_16((b) + 16), LX_TOK2_16((b) + 32), LX_TOK2_16((b) + 48)
+
+static const lx_tok2_t lx_tok2[256] =
+{
+    LX_TOK2_64(0), LX_TOK2_64(64), LX_TOK2_64(128), LX_TOK2_64(192)
+};
+
+#endif // LX_UNPACK_IMPLEMENTATION || LX_UNPACK_TEMPLATES
+
+#ifdef LX_UNPACK_IMPLEMENTATION
+
+#ifdef __cplusplus
+
+// C++ builds take the decoders from the templates
+#include "lxunpack.hpp"
+
 // unpack one page, packed with EXEPACK:1
 int16_t lx_unpack1(uint8_t *dst, uint8_t *src, int16_t src_size)
 {
-    int16_t dst_size = LX_PAGE_SIZE;
+    return lx::unpack1<lx::checked, lx::wide_copy, lx::page_out>(dst, LX_PAGE_SIZE, src, src_size);
+}
+
+// unpack one page, packed with EXEPACK:1, into dst_size bytes
+int16_t lx_unpack1_span(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size)
+{
+    return lx::unpack1<lx::checked, lx::wide_copy, lx::span_out>(dst, dst_size, src, src_size);
+}
+
+// unpacked size of the page packed with EXEPACK:1
+int16_t lx_unpack1_size(const uint8_t *src, int16_t src_size)
+{
+    return lx::unpack1<lx::checked, lx::wide_copy, lx::size_out>(NULL, LX_PAGE_SIZE, src, src_size);
+}
+
+// unpack one page, packed with EXEPACK:2
+int16_t lx_unpack2(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    return lx::unpack2<lx::checked, lx::wide_copy, lx::page_out>(dst, LX_PAGE_SIZE, src, src_size);
+}
+
+// unpack one page, packed with EXEPACK:2, into dst_size bytes
+int16_t lx_unpack2_span(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size)
+{
+    return lx::unpack2<lx::checked, lx::wide_copy, lx::span_out>(dst, dst_size, src, src_size);
+}
+
+// unpacked size of the page packed with EXEPACK:2
+int16_t lx_unpack2_size(const uint8_t *src, int16_t src_size)
+{
+    return lx::unpack2<lx::checked, lx::wide_copy, lx::size_out>(NULL, LX_PAGE_SIZE, src, src_size);
+}
+
+// unpack EXEPACK:2 page already checked with lx_unpack2_size
+int16_t lx_unpack2_unchecked(uint8_t *dst, const uint8_t *src, int16_t src_size)
+{
+    return lx::unpack2<lx::unchecked, lx::wide_copy, lx::page_out>(dst, LX_PAGE_SIZE, src, src_size);
+}
+
+#else // __cplusplus
+
+// room for the span decoders, page never unpacks to more than LX_PAGE_SIZE bytes
+#define LX_SPAN_ROOM(size)             (((size) < LX_PAGE_SIZE) ? (((size) > 0) ? (size) : 0) : LX_PAGE_SIZE)
+
+// unpack one page, packed with EXEPACK:1
+int16_t lx_unpack1(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    return lx_unpack1_span(dst, LX_PAGE_SIZE, src, src_size);
+}
+
+// unpack one page, packed with EXEPACK:1, into dst_size bytes
+int16_t lx_unpack1_span(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size)
+{
+    const int16_t room = LX_SPAN_ROOM(dst_size);
     uint16_t nr;
     uint16_t len;
 
+    dst_size = room;
     while (src_size > 0)
     {
         // first two bytes are the number of repetitions
-        nr = src[0] | ( (uint16_t)src[1] << 16);
+        nr = src[0] | ( (uint16_t)src[1] << 8);
         if (!nr)
         {
             // end marker
             goto done;
         }
         // second two bytes are the length of repeated literal
-        len = src[2] | ( (uint16_t)src[3] << 16);
+        len = src[2] | ( (uint16_t)src[3] << 8);
         src += 4;
+        // 16-bit len must not wrap the 16-bit sizes
+        if (len + 4 > src_size)
+        {
+            goto bad_data;
+        }
         src_size -= len + 4;
-        if (src_size < 0)
+        // all repetitions at once
+        if ((uint32_t)nr * len > (uint32_t)dst_size)
+        {
+            goto bad_data;
+        }
+        dst_size -= nr * len;
+        if (len == 1)
+        {
+            // single byte repeated
+            lx_fill(dst, src[0], nr);
+        }
+        else if (len)
+        {
+            lx_copy(dst, src, len, LX_NO_OVERLAP);
+            lx_repeat(dst, len, nr * len);
+        }
+        dst += nr * len;
+        src += len;
+    }
+done:    
+    return room - dst_size;
+bad_data:
+    return -1;
+}
+
+// unpacked size of the page packed with EXEPACK:1
+int16_t lx_unpack1_size(const uint8_t *src, int16_t src_size)
+{
+    int16_t dst_size = LX_PAGE_SIZE;
+    uint16_t nr;
+    uint16_t len;
+
+    while (src_size > 0)
+    {
+        nr = src[0] | ( (uint16_t)src[1] << 8);
+        if (!nr)
+        {
+            // end marker
+            goto done;
+        }
+        len = src[2] | ( (uint16_t)src[3] << 8);
+        if (len + 4 > src_size)
         {
             goto bad_data;
         }
-        while (nr--)
+        src += len + 4;
+        src_size -= len + 4;
+        // all repetitions at once
+        if ((uint32_t)nr * len > (uint32_t)dst_size)
         {
+            goto bad_data;
+        }
+        dst_size -= nr * len;
+    }
+done:
+    return LX_PAGE_SIZE - dst_size;
+bad_data:
+    return -1;
+}
+
+// unpack one page, packed with EXEPACK:2
+int16_t lx_unpack2(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    return lx_unpack2_span(dst, LX_PAGE_SIZE, src, src_size);
+}
+
+// unpack one page, packed with EXEPACK:2, into dst_size bytes
+// algorithm based on the A.Wynn and J.Wu paper 
+// with clarifications from archiveteam.org
+int16_t lx_unpack2_span(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size)
+{
+    const int16_t room = LX_SPAN_ROOM(dst_size);
+    const lx_tok2_t *tok;
+    uint16_t len, off;
+
+    dst_size = room;
+    while (src_size > 0)
+    {
+        tok = &lx_tok2[src[0]];
+        if (!tok->hdr)
+        {
+            if (src_size < 2)
+            {
+                goto bad_data;
+            }
+            // iterated bytes
+            len = src[1];
+            if (!len)
+            {
+                // end marker
+                goto done;
+            }
+            src_size -= 3;
             dst_size -= len;
-            if (dst_size < 0)
+            if ((src_size < 0) || (dst_size < 0))
             {
                 goto bad_data;
             }
-            bcopy(dst, src, len);
+            lx_fill(dst, src[2], len);
             dst += len;
+            src += 3;
+            continue;
         }
-        src += len;
+        // mid token header is not checked against the input size,
+        // long token literals are not
+        src_size -= tok->hdr + tok->nr - tok->late;
+        dst_size -= tok->nr;
+        if ((src_size < tok->min) || (dst_size < 0))
+        {
+            goto bad_data;
+        }
+        len = tok->len | ((src[1] & tok->lmask) << 2);
+        off = ((src[tok->oidx] | ((uint16_t)src[tok->oidx + 1] << 8)) >> tok->oshift) & tok->omask;
+        src += tok->hdr;
+        // copy uncompressed bytes, if any
+        lx_copy(dst, src, tok->nr, LX_NO_OVERLAP);
+        dst += tok->nr;
+        src += tok->nr;
+        src_size -= tok->late;
+        if (off > (room - dst_size))
+        {
+            goto bad_data;
+        }
+        dst_size -= len;
+        if (dst_size < 0)
+        {
+            goto bad_data;
+        }
+        // copy repeated bytes
+        lx_copy_back(dst, off, len);
+        dst += len;
     }
-done:    
+done:
+    return room - dst_size;
+bad_data:
+    return -1;
+}
+
+// unpacked size of the page packed with EXEPACK:2
+int16_t lx_unpack2_size(const uint8_t *src, int16_t src_size)
+{
+    int16_t dst_size = LX_PAGE_SIZE;
+    const lx_tok2_t *tok;
+    uint16_t len, off;
+
+    while (src_size > 0)
+    {
+        tok = &lx_tok2[src[0]];
+        if (!tok->hdr)
+        {
+            if (src_size < 2)
+            {
+                goto bad_data;
+            }
+            len = src[1];
+            if (!len)
+            {
+                // end marker
+                goto done;
+            }
+            src_size -= 3;
+            dst_size -= len;
+            if ((src_size < 0) || (dst_size < 0))
+            {
+                goto bad_data;
+            }
+            src += 3;
+            continue;
+        }
+        src_size -= tok->hdr + tok->nr - tok->late;
+        dst_size -= tok->nr;
+        if ((src_size < tok->min) || (dst_size < 0))
+        {
+            goto bad_data;
+        }
+        len = tok->len | ((src[1] & tok->lmask) << 2);
+        off = ((src[tok->oidx] | ((uint16_t)src[tok->oidx + 1] << 8)) >> tok->oshift) & tok->omask;
+        src += tok->hdr + tok->nr;
+        src_size -= tok->late;
+        if (off > (LX_PAGE_SIZE - dst_size))
+        {
+            goto bad_data;
+        }
+        dst_size -= len;
+        if (dst_size < 0)
+        {
+            goto bad_data;
+        }
+    }
+done:
     return LX_PAGE_SIZE - dst_size;
 bad_data:
     return -1;
 }
 
-// unpack one page, packed with EXEPACK:2 
-// algorithm based on the A.Wynn and J.Wu paper 
-// with clarifications from archiveteam.org
-int16_t lx_unpack2(uint8_t *dst, uint8_t *src, int16_t src_size)
+// unpack EXEPACK:2 page already checked with lx_unpack2_size
+int16_t lx_unpack2_unchecked(uint8_t *dst, const uint8_t *src, int16_t src_size)
 {
     int16_t dst_size = LX_PAGE_SIZE;
+    const lx_tok2_t *tok;
+    uint16_t len, off;
 
+    // no bounds checks at all, input size is counted only to find its end
     while (src_size > 0)
     {
-        switch (src[0] & 3)
+        tok = &lx_tok2[src[0]];
+        if (!tok->hdr)
         {
-            case 0: // nroots
-                {
-                    uint8_t len;
-
-                    len = src[0] >> 2;
-                    if (len)
-                    {
-                        // non-compressed bytes
-                        src_size -= len + 1;
-                        dst_size -= len;
-                        if ((src_size < 0) || (dst_size < 0))
-                        {
-                            goto bad_data;
-                        }
-                        bcopy(dst, &src[1], len);
-                        dst += len;
-                        src += len + 1;
-                    }
-                    else if (src_size >= 2)
-                    {
-                        // iterated bytes
-                        len = src[1];
-                        if (len)
-                        {
-                            src_size -= 3;
-                            dst_size -= len;
-                            if ((src_size < 0) || (dst_size < 0))
-                            {
-                                goto bad_data;
-                            }
-                            bfill(dst, src[2], len);
-                            dst += len;
-                            src += 3;
-                        }
-                        else
-                        {
-                            // end marker
-                            goto done;
-                        }
-                    }
-                    else
-                    {
-                        goto bad_data;
-                    }
-                }
-                break;
+            len = src[1];
+            if (!len)
+            {
+                // end marker
+                goto done;
+            }
+            lx_fill(dst, src[2], len);
+            dst += len;
+            dst_size -= len;
+            src += 3;
+            src_size -= 3;
+            continue;
+        }
+        len = tok->len | ((src[1] & tok->lmask) << 2);
+        off = ((src[tok->oidx] | ((uint16_t)src[tok->oidx + 1] << 8)) >> tok->oshift) & tok->omask;
+        src += tok->hdr;
+        src_size -= tok->hdr;
+        lx_copy(dst, src, tok->nr, LX_NO_OVERLAP);
+        dst += tok->nr;
+        src += tok->nr;
+        src_size -= tok->nr;
+        dst_size -= tok->nr;
+        lx_copy_back(dst, off, len);
+        dst += len;
+        dst_size -= len;
+    }
+done:
+    return LX_PAGE_SIZE - dst_size;
+}
 
-            case 1: // short string token 
-                {
-                    uint8_t nr, len;
-                    uint16_t off;
-
-                    // uncompressed bytes count
-                    nr = (src[0] & 0x0C) >> 2;
-                    // repeated string length
-                    len = ((src[0] & 0x70) >> 4) + 3;
-                    // 9-bit offset into dst
-                    off = ((uint16_t)src[1] << 1) | (src[0] >> 7);
-                    src += 2;
-                    src_size -= nr + 2;
-                    dst_size -= nr;
-                    if ((src_size < 0) || (dst_size < 0))
-                    {
-                        goto bad_data;
-                    }
-                    // copy uncompressed bytes, if any
-                    bcopy(dst, src, nr);
-                    dst += nr;
-                    src += nr;
-                    if (off > (LX_PAGE_SIZE - dst_size))
-                    {
-                        goto bad_data;
-                    }
-                    dst_size -= len;
-                    if (dst_size < 0)
-                    {
-                        goto bad_data;
-                    }
-                    // copy repeated bytes
-                    bcopy(dst, dst - off, len);
-                    dst += len;
-                }
-                break;
+#endif // __cplusplus
+
+// lx_unpack2_state_t states
+#define LX_STREAM_TOKEN                0       // token header
+#define LX_STREAM_LITERAL              1       // literal bytes, then the string, if any
+#define LX_STREAM_DONE                 2       // end marker found
+#define LX_STREAM_ERROR                3       // bad data
+
+// start unpacking of one page into dst
+void lx_unpack2_init(lx_unpack2_state_t *st, uint8_t *dst)
+{
+    st->dst = dst;
+    st->dst_size = LX_PAGE_SIZE;
+    st->state = LX_STREAM_TOKEN;
+    st->tok_len = 0;
+    st->lit = 0;
+    st->string = 0;
+    st->len = 0;
+    st->off = 0;
+}
+
+// copy repeated string of the current token
+static int16_t lx_unpack2_string(lx_unpack2_state_t *st)
+{
+    if ((st->off > (LX_PAGE_SIZE - st->dst_size)) || (st->len > st->dst_size))
+    {
+        return -1;
+    }
+    st->dst_size -= st->len;
+    lx_copy_back(st->dst, st->off, st->len);
+    st->dst += st->len;
+    st->string = 0;
+    return 0;
+}
+
+// decode complete token header, same rules as lx_unpack2
+static int16_t lx_unpack2_token(lx_unpack2_state_t *st)
+{
+    uint8_t *tok = st->tok;
 
-            case 2: // mid string token
+    st->string = (tok[0] & 3) != 0;
+    switch (tok[0] & 3)
+    {
+        case 0:
+            if (tok[0] >> 2)
+            {
+                // non-compressed bytes
+                st->lit = tok[0] >> 2;
+            }
+            else if (tok[1])
+            {
+                // iterated bytes
+                if (tok[1] > st->dst_size)
                 {
-                    uint8_t len;
-                    uint16_t off;
-
-                    // repeated string length
-                    len = ((src[0] & 0x0C) >> 2) + 3;
-                    // 12-bit offset into dst
-                    off = ( (uint16_t)src[1] << 4) | (src[0] >> 4);
-                    src += 2;
-                    src_size -= 2;
-                    if (off > (LX_PAGE_SIZE - dst_size))
-                    {
-                        goto bad_data;
-                    }
-                    dst_size -= len;
-                    if (dst_size < 0)
-                    {
-                        goto bad_data;
-                    }
-                    bcopy(dst, dst - off, len);
-                    dst += len;
+                    return -1;
                 }
-                break;
+                st->dst_size -= tok[1];
+                lx_fill(st->dst, tok[2], tok[1]);
+                st->dst += tok[1];
+                return 0;
+            }
+            else
+            {
+                // end marker
+                st->state = LX_STREAM_DONE;
+                return 0;
+            }
+            break;
+
+        case 1: // short string token
+            st->lit = (tok[0] & 0x0C) >> 2;
+            st->len = ((tok[0] & 0x70) >> 4) + 3;
+            st->off = ((uint16_t)tok[1] << 1) | (tok[0] >> 7);
+            break;
 
-            case 3: // long string
+        case 2: // mid string token
+            st->len = ((tok[0] & 0x0C) >> 2) + 3;
+            st->off = ((uint16_t)tok[1] << 4) | (tok[0] >> 4);
+            return lx_unpack2_string(st);
+
+        case 3: // long string
+            st->lit = (tok[0] & 0x3C) >> 2;
+            st->len = (((uint16_t)tok[1] & 0x0F) << 2) | ((tok[0] & 0xC0) >> 6);
+            st->off = ((tok[1] & 0xF0) >> 4) | ((uint16_t)tok[2] << 4);
+            break;
+    }
+    // room for the literals is reserved ahead, as lx_unpack2 does
+    if (st->lit > st->dst_size)
+    {
+        return -1;
+    }
+    st->dst_size -= st->lit;
+    if (st->lit)
+    {
+        st->state = LX_STREAM_LITERAL;
+        return 0;
+    }
+    return st->string ? lx_unpack2_string(st) : 0;
+}
+
+// unpack next chunk of packed data
+int16_t lx_unpack2_feed(lx_unpack2_state_t *st, const uint8_t *src, int16_t src_size)
+{
+    uint8_t need;
+    uint8_t k;
+
+    if (src_size < 0)
+    {
+        st->state = LX_STREAM_ERROR;
+    }
+    while ((src_size > 0) && (st->state < LX_STREAM_DONE))
+    {
+        if (st->state == LX_STREAM_TOKEN)
+        {
+            st->tok[st->tok_len++] = *src++;
+            src_size--;
+            // token header size is known from its first bytes
+            switch (st->tok[0] & 3)
+            {
+                case 0:
+                    need = (st->tok[0] >> 2) ? 1 : ((st->tok_len < 2) || st->tok[1]) ? 3 : 2;
+                    break;
+
+                case 3:
+                    need = 3;
+                    break;
+
+                default:
+                    need = 2;
+                    break;
+            }
+            if (st->tok_len < need)
+            {
+                continue;
+            }
+            st->tok_len = 0;
+            if (lx_unpack2_token(st))
+            {
+                st->state = LX_STREAM_ERROR;
+            }
+        }
+        else
+        {
+            // literal bytes, as many as available
+            k = (src_size < st->lit) ? (uint8_t)src_size : st->lit;
+            lx_copy(st->dst, src, k, LX_NO_OVERLAP);
+            st->dst += k;
+            src += k;
+            src_size -= k;
+            st->lit -= k;
+            if (!st->lit)
+            {
+                st->state = LX_STREAM_TOKEN;
+                if (st->string && lx_unpack2_string(st))
                 {
-                    uint8_t nr, len;
-                    uint16_t off;
-
-                    // uncompressed bytes count
-                    nr = (src[0] & 0x3C) >> 2;
-                    // repeated string length
-                    len = ( ( (uint16_t)src[1] & 0x0F) << 2) | ((src[0] & 0xC0) >> 6);
-                    // 12-bit offset into dst
-                    off = ( (src[1] & 0xF0) >> 4) | ( (uint16_t)src[2] << 4);
-                    src += 3;
-                    src_size -= 3;
-                    dst_size -= nr;
-                    if ((src_size < 0) || (dst_size < 0))
-                    {
-                        goto bad_data;
-                    }
-                    // copy uncompressed bytes, if any
-                    bcopy(dst, src, nr);
-                    dst += nr;
-                    src += nr;
-                    src_size -= nr;
-                    if (off > (LX_PAGE_SIZE - dst_size))
-                    {
-                        goto bad_data;
-                    }
-                    dst_size -= len;
-                    if (dst_size < 0)
-                    {
-                        goto bad_data;
-                    }
-                    // copy repeated bytes
-                    bcopy(dst, dst - off, len);
-                    dst += len;
+                    st->state = LX_STREAM_ERROR;
                 }
-                break;
+            }
         }
     }
-done:
-    return LX_PAGE_SIZE - dst_size;
-bad_data:
+    return (st->state == LX_STREAM_ERROR) ? -1 : (st->state == LX_STREAM_DONE) ? 1 : 0;
+}
+
+// end of packed data
+int16_t lx_unpack2_finish(lx_unpack2_state_t *st)
+{
+    if ( (st->state == LX_STREAM_DONE) ||
+         ((st->state == LX_STREAM_TOKEN) && !st->tok_len)
+       )
+    {
+        return LX_PAGE_SIZE - st->dst_size;
+    }
     return -1;
 }
 
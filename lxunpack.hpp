@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: MIT
+// C++ core of lxunpack.h: EXEPACK decoders templated on policies, so every
+// combination is specialized and inlined at compile time with no runtime flags.
+// Include it alone, or lxunpack.h with LX_UNPACK_IMPLEMENTATION into a C++
+// source, then lx_unpack1/lx_unpack2 and friends are instantiations of it.
+#ifndef LX_UNPACK_TEMPLATES
+#define LX_UNPACK_TEMPLATES
+#endif
+#include "lxunpack.h"
+
+#ifndef __HPP_LX_UNPACK__
+#define __HPP_LX_UNPACK__
+
+#include <stddef.h>
+
+#ifndef LX_NO_OVERLAP
+#error "lxunpack.h was included before without LX_UNPACK_TEMPLATES or LX_UNPACK_IMPLEMENTATION"
+#endif
+
+// may be reached from within extern "C" of another header
+extern "C++"
+{
+
+namespace lx
+{
+
+// copy 16 bytes as two words, src may lie at least 8 bytes behind dst
+static inline void copy16(uint8_t *dst, const uint8_t *src)
+{
+    *(lx_u64u_t *)dst = *(const lx_u64u_t *)src;
+    *(lx_u64u_t *)(dst + 8) = *(const lx_u64u_t *)(src + 8);
+}
+
+// bounds policies
+struct checked                   // every token is checked, bad data gives -1
+{
+    static const bool check = true;
+};
+
+struct unchecked                 // no checks, page must be known to be good
+{
+    static const bool check = false;
+};
+
+// copy policies
+struct byte_copy                 // byte by byte, as the original decoder
+{
+    static const bool wide = false;
+
+    static void copy(uint8_t *dst, const uint8_t *src, uint16_t len)
+    {
+        for (; len > 0; len--)
+        {
+            *dst++ = *src++;
+        }
+    }
+
+    static void fill(uint8_t *dst, uint8_t val, uint16_t len)
+    {
+        for (; len > 0; len--)
+        {
+            *dst++ = val;
+        }
+    }
+
+    static void copy_back(uint8_t *dst, uint16_t off, uint16_t len)
+    {
+        for (; len > 0; len--, dst++)
+        {
+            *dst = dst[-(int)off];
+        }
+    }
+
+    static void repeat(uint8_t *dst, uint16_t len, uint16_t total)
+    {
+        uint16_t i;
+
+        for (i = len; i < total; i++)
+        {
+            dst[i] = dst[i - len];
+        }
+    }
+};
+
+struct wide_copy                 // words and vectors, 16 bytes at once into scratch_out
+{
+    static const bool wide = true;
+
+    static void copy(uint8_t *dst, const uint8_t *src, uint16_t len)
+    {
+        lx_copy(dst, src, len, LX_NO_OVERLAP);
+    }
+
+    static void fill(uint8_t *dst, uint8_t val, uint16_t len)
+    {
+        lx_fill(dst, val, len);
+    }
+
+    static void copy_back(uint8_t *dst, uint16_t off, uint16_t len)
+    {
+        lx_copy_back(dst, off, len);
+    }
+
+    static void repeat(uint8_t *dst, uint16_t len, uint16_t total)
+    {
+        lx_repeat(dst, len, total);
+    }
+};
+
+// output policies
+struct page_out                  // whole LX_PAGE_SIZE page
+{
+    static const bool write = true;
+    static const bool scratch = false;
+
+    static int16_t room(int16_t)
+    {
+        return LX_PAGE_SIZE;
+    }
+};
+
+struct span_out                  // dst_size bytes anywhere, e.g. within an object
+{
+    static const bool write = true;
+    static const bool scratch = false;
+
+    static int16_t room(int16_t dst_size)
+    {
+        // page never unpacks to more than LX_PAGE_SIZE bytes
+        return (dst_size < LX_PAGE_SIZE) ? ((dst_size > 0) ? dst_size : 0) : LX_PAGE_SIZE;
+    }
+};
+
+// whole page of a private buffer: EXEPACK:2 short copies may write up to 16
+// bytes at once, so bytes past the unpacked size and under strings with zero
+// offset are left undefined, unlike page_out which matches byte_copy exactly
+struct scratch_out
+{
+    static const bool write = true;
+    static const bool scratch = true;
+
+    static int16_t room(int16_t)
+    {
+        return LX_PAGE_SIZE;
+    }
+};
+
+struct size_out                  // nothing is written, only the size is counted
+{
+    static const bool write = false;
+    static const bool scratch = false;
+
+    static int16_t room(int16_t)
+    {
+        return LX_PAGE_SIZE;
+    }
+};
+
+// stats policies
+struct no_stats
+{
+    void literal(uint16_t) {}
+    void fill(uint16_t) {}
+    void string(uint16_t) {}
+};
+
+struct stats                     // what the page is made of
+{
+    uint32_t    literals;        // literal runs and EXEPACK:1 records
+    uint32_t    fills;           // iterated bytes runs
+    uint32_t    strings;         // repeated strings
+    uint32_t    literal_bytes;
+    uint32_t    fill_bytes;
+    uint32_t    string_bytes;
+
+    stats() : literals(0), fills(0), strings(0), literal_bytes(0), fill_bytes(0), string_bytes(0) {}
+
+    void literal(uint16_t len)
+    {
+        if (len)
+        {
+            literals++;
+            literal_bytes += len;
+        }
+    }
+
+    void fill(uint16_t len)
+    {
+        fills++;
+        fill_bytes += len;
+    }
+
+    void string(uint16_t len)
+    {
+        if (len)
+        {
+            strings++;
+            string_bytes += len;
+        }
+    }
+};
+
+// unpack page packed with EXEPACK:1, returns unpacked size or -1
+template <class Bounds, class Copy, class Out, class Stats>
+int16_t unpack1(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size, Stats &st)
+{
+    const int16_t room = Out::room(dst_size);
+    uint16_t nr;
+    uint16_t len;
+
+    dst_size = room;
+    while (src_size > 0)
+    {
+        // number of repetitions, end marker if 0
+        nr = src[0] | ((uint16_t)src[1] << 8);
+        if (!nr)
+        {
+            break;
+        }
+        // length of repeated literal
+        len = src[2] | ((uint16_t)src[3] << 8);
+        if (Bounds::check && (len + 4 > src_size))
+        {
+            return -1;
+        }
+        src += 4;
+        src_size -= len + 4;
+        if (Bounds::check && ((uint32_t)nr * len > (uint32_t)dst_size))
+        {
+            return -1;
+        }
+        dst_size -= nr * len;
+        st.literal(nr * len);
+        if (Out::write && len)
+        {
+            // one copy of the literal, the rest repeats it
+            if (len == 1)
+            {
+                Copy::fill(dst, src[0], nr);
+            }
+            else
+            {
+                Copy::copy(dst, src, len);
+                Copy::repeat(dst, len, nr * len);
+            }
+            dst += nr * len;
+        }
+        src += len;
+    }
+    return room - dst_size;
+}
+
+// unpack page packed with EXEPACK:2, returns unpacked size or -1
+template <class Bounds, class Copy, class Out, class Stats>
+int16_t unpack2(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size, Stats &st)
+{
+    const int16_t room = Out::room(dst_size);
+    const lx_tok2_t *tok;
+    uint16_t len, off;
+
+    dst_size = room;
+    while (src_size > 0)
+    {
+        tok = &lx_tok2[src[0]];
+        if (!tok->hdr)
+        {
+            if (Bounds::check && (src_size < 2))
+            {
+                return -1;
+            }
+            // iterated bytes, end marker if 0
+            len = src[1];
+            if (!len)
+            {
+                break;
+            }
+            src_size -= 3;
+            dst_size -= len;
+            if (Bounds::check && ((src_size < 0) || (dst_size < 0)))
+            {
+                return -1;
+            }
+            st.fill(len);
+            if (Out::write)
+            {
+                Copy::fill(dst, src[2], len);
+                dst += len;
+            }
+            src += 3;
+            continue;
+        }
+        // mid token header is not checked against the input size,
+        // long token literals are not
+        src_size -= tok->hdr + tok->nr - tok->late;
+        dst_size -= tok->nr;
+        if (Bounds::check && ((src_size < tok->min) || (dst_size < 0)))
+        {
+            return -1;
+        }
+        len = tok->len | ((src[1] & tok->lmask) << 2);
+        off = ((src[tok->oidx] | ((uint16_t)src[tok->oidx + 1] << 8)) >> tok->oshift) & tok->omask;
+        src += tok->hdr;
+        st.literal(tok->nr);
+        if (Out::write)
+        {
+            if (Copy::wide && Out::scratch && (tok->nr <= 16) && (src_size >= 16) && (dst_size >= 16))
+            {
+                copy16(dst, src);
+            }
+            else
+            {
+                Copy::copy(dst, src, tok->nr);
+            }
+            dst += tok->nr;
+        }
+        src += tok->nr;
+        src_size -= tok->late;
+        if (Bounds::check && (off > room - dst_size))
+        {
+            return -1;
+        }
+        dst_size -= len;
+        if (Bounds::check && (dst_size < 0))
+        {
+            return -1;
+        }
+        st.string(len);
+        if (Out::write)
+        {
+            if (Copy::wide && Out::scratch && (len <= 16) && (off >= 8) && (dst_size + len >= 16))
+            {
+                copy16(dst, dst - off);
+            }
+            else
+            {
+                Copy::copy_back(dst, off, len);
+            }
+            dst += len;
+        }
+    }
+    return room - dst_size;
+}
+
+// same without stats
+template <class Bounds, class Copy, class Out>
+int16_t unpack1(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size)
+{
+    no_stats st;
+
+    return unpack1<Bounds, Copy, Out>(dst, dst_size, src, src_size, st);
+}
+
+template <class Bounds, class Copy, class Out>
+int16_t unpack2(uint8_t *dst, int16_t dst_size, const uint8_t *src, int16_t src_size)
+{
+    no_stats st;
+
+    return unpack2<Bounds, Copy, Out>(dst, dst_size, src, src_size, st);
+}
+
+} // namespace lx
+
+} // extern "C++"
+
+#endif // __HPP_LX_UNPACK__
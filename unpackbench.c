@@ -0,0 +1,718 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#define LX_UNPACK_IMPLEMENTATION
+#include "lxunpack.h"
+#define LX_PACK_IMPLEMENTATION
+#include "lxpack.h"
+#define LX_MODULE_IMPLEMENTATION
+#include "lxmodule.h"
+
+// Throughput of the EXEPACK decoders over synthetic and real page sets,
+// against the original byte-by-byte decoders below
+
+#define SYNTH_PAGES                    256
+#define MAX_PAGES                      65536
+
+typedef int16_t (*unpack_fn)(uint8_t *dst, uint8_t *src, int16_t src_size);
+
+// set of packed pages, all of the same method
+typedef struct corpus_s
+{
+    const char *name;
+    int         mode;            // 1 - EXEPACK:1, 2 - EXEPACK:2
+    uint32_t    count;
+    uint8_t   **page;            // packed pages
+    int16_t    *size;            // their sizes
+    uint64_t    tokens[5];       // token mix: literal, fill, short, mid, long
+} corpus_t;
+
+// decoder under test
+typedef struct decoder_s
+{
+    const char *name;
+    unpack_fn   unpack1;
+    unpack_fn   unpack2;
+    int         size_only;       // output is not written, only its size is checked
+} decoder_t;
+
+// original byte loops, the baseline (with the EXEPACK:1 length shift fixed)
+static void byte_copy(uint8_t *dst, uint8_t *src, uint16_t len)
+{
+    for (; len > 0; len--)
+    {
+        *dst++ = *src++;
+    }
+}
+
+// simple byte fill (memset-like)
+static void byte_fill(uint8_t *dst, uint8_t val, uint16_t len)
+{
+    for (; len > 0; len--)
+    {
+        *dst++ = val;
+    }
+}
+
+// unpack one page, packed with EXEPACK:1
+static int16_t byte_unpack1(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    int16_t dst_size = LX_PAGE_SIZE;
+    uint16_t nr;
+    uint16_t len;
+
+    while (src_size > 0)
+    {
+        // first two bytes are the number of repetitions
+        nr = src[0] | ( (uint16_t)src[1] << 8);
+        if (!nr)
+        {
+            // end marker
+            goto done;
+        }
+        // second two bytes are the length of repeated literal
+        len = src[2] | ( (uint16_t)src[3] << 8);
+        src += 4;
+        src_size -= len + 4;
+        if (src_size < 0)
+        {
+            goto bad_data;
+        }
+        while (nr--)
+        {
+            dst_size -= len;
+            if (dst_size < 0)
+            {
+                goto bad_data;
+            }
+            byte_copy(dst, src, len);
+            dst += len;
+        }
+        src += len;
+    }
+done:
+    return LX_PAGE_SIZE - dst_size;
+bad_data:
+    return -1;
+}
+
+// unpack one page, packed with EXEPACK:2 
+// algorithm based on the A.Wynn and J.Wu paper 
+// with clarifications from archiveteam.org
+static int16_t byte_unpack2(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    int16_t dst_size = LX_PAGE_SIZE;
+
+    while (src_size > 0)
+    {
+        switch (src[0] & 3)
+        {
+            case 0: // nroots
+                {
+                    uint8_t len;
+
+                    len = src[0] >> 2;
+                    if (len)
+                    {
+                        // non-compressed bytes
+                        src_size -= len + 1;
+                        dst_size -= len;
+                        if ((src_size < 0) || (dst_size < 0))
+                        {
+                            goto bad_data;
+                        }
+                        byte_copy(dst, &src[1], len);
+                        dst += len;
+                        src += len + 1;
+                    }
+                    else if (src_size >= 2)
+                    {
+                        // iterated bytes
+                        len = src[1];
+                        if (len)
+                        {
+                            src_size -= 3;
+                            dst_size -= len;
+                            if ((src_size < 0) || (dst_size < 0))
+                            {
+                                goto bad_data;
+                            }
+                            byte_fill(dst, src[2], len);
+                            dst += len;
+                            src += 3;
+                        }
+                        else
+                        {
+                            // end marker
+                            goto done;
+                        }
+                    }
+                    else
+                    {
+                        goto bad_data;
+                    }
+                }
+                break;
+
+            case 1: // short string token 
+                {
+                    uint8_t nr, len;
+                    uint16_t off;
+
+                    // uncompressed bytes count
+                    nr = (src[0] & 0x0C) >> 2;
+                    // repeated string length
+                    len = ((src[0] & 0x70) >> 4) + 3;
+                    // 9-bit offset into dst
+                    off = ((uint16_t)src[1] << 1) | (src[0] >> 7);
+                    src += 2;
+                    src_size -= nr + 2;
+                    dst_size -= nr;
+                    if ((src_size < 0) || (dst_size < 0))
+                    {
+                        goto bad_data;
+                    }
+                    // copy uncompressed bytes, if any
+                    byte_copy(dst, src, nr);
+                    dst += nr;
+                    src += nr;
+                    if (off > (LX_PAGE_SIZE - dst_size))
+                    {
+                        goto bad_data;
+                    }
+                    dst_size -= len;
+                    if (dst_size < 0)
+                    {
+                        goto bad_data;
+                    }
+                    // copy repeated bytes
+                    byte_copy(dst, dst - off, len);
+                    dst += len;
+                }
+                break;
+
+            case 2: // mid string token
+                {
+                    uint8_t len;
+                    uint16_t off;
+
+                    // repeated string length
+                    len = ((src[0] & 0x0C) >> 2) + 3;
+                    // 12-bit offset into dst
+                    off = ( (uint16_t)src[1] << 4) | (src[0] >> 4);
+                    src += 2;
+                    src_size -= 2;
+                    if (off > (LX_PAGE_SIZE - dst_size))
+                    {
+                        goto bad_data;
+                    }
+                    dst_size -= len;
+                    if (dst_size < 0)
+                    {
+                        goto bad_data;
+                    }
+                    byte_copy(dst, dst - off, len);
+                    dst += len;
+                }
+                break;
+
+            case 3: // long string
+                {
+                    uint8_t nr, len;
+                    uint16_t off;
+
+                    // uncompressed bytes count
+                    nr = (src[0] & 0x3C) >> 2;
+                    // repeated string length
+                    len = ( ( (uint16_t)src[1] & 0x0F) << 2) | ((src[0] & 0xC0) >> 6);
+                    // 12-bit offset into dst
+                    off = ( (src[1] & 0xF0) >> 4) | ( (uint16_t)src[2] << 4);
+                    src += 3;
+                    src_size -= 3;
+                    dst_size -= nr;
+                    if ((src_size < 0) || (dst_size < 0))
+                    {
+                        goto bad_data;
+                    }
+                    // copy uncompressed bytes, if any
+                    byte_copy(dst, src, nr);
+                    dst += nr;
+                    src += nr;
+                    src_size -= nr;
+                    if (off > (LX_PAGE_SIZE - dst_size))
+                    {
+                        goto bad_data;
+                    }
+                    dst_size -= len;
+                    if (dst_size < 0)
+                    {
+                        goto bad_data;
+                    }
+                    // copy repeated bytes
+                    byte_copy(dst, dst - off, len);
+                    dst += len;
+                }
+                break;
+        }
+    }
+done:
+    return LX_PAGE_SIZE - dst_size;
+bad_data:
+    return -1;
+}
+
+// scan modes, no output
+static int16_t size_unpack1(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    (void)dst;
+    return lx_unpack1_size(src, src_size);
+}
+
+static int16_t size_unpack2(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    (void)dst;
+    return lx_unpack2_size(src, src_size);
+}
+
+static int16_t unchecked_unpack2(uint8_t *dst, uint8_t *src, int16_t src_size)
+{
+    return lx_unpack2_unchecked(dst, src, src_size);
+}
+
+static const decoder_t decoders[] =
+{
+    { "byte",      byte_unpack1, byte_unpack2,      0 },
+    { "current",   lx_unpack1,   lx_unpack2,        0 },
+    { "unchecked", NULL,         unchecked_unpack2, 0 },   // corpus pages pass lx_unpack2_size
+    { "size",      size_unpack1, size_unpack2,      1 },
+};
+
+#define DECODERS                       (sizeof(decoders) / sizeof(decoders[0]))
+
+static uint32_t seed = 0x2545F491;
+
+static uint32_t rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// add packed page to the corpus
+static int corpus_add(corpus_t *c, const uint8_t *data, int16_t size)
+{
+    uint8_t **page;
+    int16_t *sz;
+
+    if (c->count >= MAX_PAGES)
+    {
+        return 0;
+    }
+    page = (uint8_t **)realloc(c->page, (c->count + 1) * sizeof(uint8_t *));
+    sz = (int16_t *)realloc(c->size, (c->count + 1) * sizeof(int16_t));
+    if (page)
+    {
+        c->page = page;
+    }
+    if (sz)
+    {
+        c->size = sz;
+    }
+    if (!page || !sz || !(c->page[c->count] = (uint8_t *)malloc(size + 16)))
+    {
+        return -1;
+    }
+    memcpy(c->page[c->count], data, size);
+    c->size[c->count++] = size;
+    return 0;
+}
+
+// token mix of the EXEPACK:2 page
+static void corpus_tokens(corpus_t *c, const uint8_t *src, int16_t size)
+{
+    const uint8_t *end = src + size;
+
+    while (src < end)
+    {
+        switch (src[0] & 3)
+        {
+            case 0:
+                if (src[0] >> 2)
+                {
+                    c->tokens[0]++;
+                    src += 1 + (src[0] >> 2);
+                }
+                else if ((src + 1 < end) && src[1])
+                {
+                    c->tokens[1]++;
+                    src += 3;
+                }
+                else
+                {
+                    return;
+                }
+                break;
+
+            case 1:
+                c->tokens[2]++;
+                src += 2 + ((src[0] & 0x0C) >> 2);
+                break;
+
+            case 2:
+                c->tokens[3]++;
+                src += 2;
+                break;
+
+            default:
+                c->tokens[4]++;
+                src += 3 + ((src[0] & 0x3C) >> 2);
+                break;
+        }
+    }
+}
+
+// synthetic page contents
+#define GEN_RANDOM                     0
+#define GEN_ZERO                       1
+#define GEN_CODE                       2
+
+// x86 code-like mix of common instructions and random immediates
+static const struct
+{
+    uint8_t     len;
+    uint8_t     op[5];
+} code_ops[] =
+{
+    { 3, { 0x55, 0x8B, 0xEC } },             // push ebp; mov ebp, esp
+    { 3, { 0x8B, 0x45, 0x08 } },             // mov eax, [ebp+8]
+    { 3, { 0x89, 0x45, 0xFC } },             // mov [ebp-4], eax
+    { 5, { 0xE8, 0x00, 0x00, 0x00, 0x00 } }, // call rel32
+    { 1, { 0xC3 } },                         // ret
+    { 3, { 0x83, 0xC4, 0x08 } },             // add esp, 8
+    { 2, { 0x6A, 0x00 } },                   // push 0
+    { 1, { 0x50 } },                         // push eax
+    { 3, { 0x8B, 0xE5, 0x5D } },             // mov esp, ebp; pop ebp
+    { 4, { 0x00, 0x00, 0x00, 0x00 } },       // data
+};
+
+static void generate(uint8_t *page, int kind)
+{
+    uint32_t i, j, k;
+
+    switch (kind)
+    {
+        case GEN_RANDOM:
+            for (i = 0; i < LX_PAGE_SIZE; i++)
+            {
+                page[i] = (uint8_t)rnd();
+            }
+            break;
+
+        case GEN_ZERO:
+            memset(page, 0, LX_PAGE_SIZE);
+            for (i = 0; i < LX_PAGE_SIZE / 64; i++)
+            {
+                page[rnd() % LX_PAGE_SIZE] = (uint8_t)rnd();
+            }
+            break;
+
+        default:
+            for (i = 0; i < LX_PAGE_SIZE;)
+            {
+                k = rnd() % (sizeof(code_ops) / sizeof(code_ops[0]));
+                for (j = 0; (j < code_ops[k].len) && (i < LX_PAGE_SIZE); j++)
+                {
+                    page[i++] = code_ops[k].op[j];
+                }
+                if ((rnd() % 4 == 0) && (i < LX_PAGE_SIZE))
+                {
+                    page[i++] = (uint8_t)rnd();
+                }
+            }
+            break;
+    }
+}
+
+static int corpus_synth(corpus_t *c, const char *name, int mode, int kind)
+{
+    uint8_t page[LX_PAGE_SIZE];
+    uint8_t pack[2 * LX_PAGE_SIZE];
+    uint32_t i;
+    int16_t size;
+
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->mode = mode;
+    for (i = 0; i < SYNTH_PAGES; i++)
+    {
+        generate(page, kind);
+        if (mode == 2)
+        {
+            size = lx_pack2(pack, sizeof(pack), page, LX_PAGE_SIZE, LX_PACK_DEFAULT);
+            corpus_tokens(c, pack, size);
+        }
+        else
+        {
+            size = lx_pack1(pack, sizeof(pack), page, LX_PAGE_SIZE);
+        }
+        if ((size < 0) || corpus_add(c, pack, size))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// worst case of back-references: runs and short patterns copied
+// from 1 to 7 bytes back, with a few literals in between
+static int corpus_backref(corpus_t *c)
+{
+    uint8_t pack[2 * LX_PAGE_SIZE];
+    uint32_t i;
+    uint16_t out, len, off, nr, k;
+    int16_t size;
+
+    memset(c, 0, sizeof(*c));
+    c->name = "backref";
+    c->mode = 2;
+    for (i = 0; i < SYNTH_PAGES; i++)
+    {
+        size = 0;
+        out = 0;
+        while (out < LX_PAGE_SIZE)
+        {
+            nr = (out < 8) ? 8 : rnd() % 4;
+            off = (i & 1) ? 1 : 1 + rnd() % 7;
+            len = 3 + rnd() % 61;
+            if (out + nr + len > LX_PAGE_SIZE)
+            {
+                len = 0;
+                nr = LX_PAGE_SIZE - out;
+                if (nr > 15)
+                {
+                    nr = 15;
+                }
+            }
+            // long string token
+            pack[size++] = (uint8_t)(3 | (nr << 2) | ((len & 3) << 6));
+            pack[size++] = (uint8_t)((len >> 2) | ((off & 0x0F) << 4));
+            pack[size++] = (uint8_t)(off >> 4);
+            for (k = 0; k < nr; k++)
+            {
+                pack[size++] = (uint8_t)rnd();
+            }
+            out += nr + len;
+        }
+        corpus_tokens(c, pack, size);
+        if (corpus_add(c, pack, size))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// packed pages of the real LX file
+static int corpus_file(corpus_t *c1, corpus_t *c2, const char *name)
+{
+    lx_module_t mod;
+    uint8_t *image;
+    const uint8_t *data;
+    FILE *f;
+    long size;
+    uint32_t i;
+    int rc = -1;
+
+    f = fopen(name, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "Error to open file %s\n", name);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    image = (uint8_t *)malloc(size ? size : 1);
+    if (image && (size == (long)fread(image, 1, size, f)) &&
+        (lx_module_open(&mod, image, (uint32_t)size) == LX_MOD_OK))
+    {
+        for (i = 0; i < mod.hdr->mpages; i++)
+        {
+            data = lx_page_data(&mod, i);
+            if (!data || (mod.map[i].size > 0x7FFF))
+            {
+                continue;
+            }
+            // corrupted pages would make the byte reference and lx_unpack2_unchecked
+            // write out of bounds, both methods take only pages passing the size pass
+            if (mod.map[i].flags == LX_PAGE_ITERDATA)
+            {
+                if (lx_unpack1_size(data, (int16_t)mod.map[i].size) < 0)
+                {
+                    continue;
+                }
+                corpus_add(c1, data, (int16_t)mod.map[i].size);
+            }
+            else if (mod.map[i].flags == LX_PAGE_ITERDATA2)
+            {
+                if (lx_unpack2_size(data, (int16_t)mod.map[i].size) < 0)
+                {
+                    continue;
+                }
+                corpus_tokens(c2, data, (int16_t)mod.map[i].size);
+                corpus_add(c2, data, (int16_t)mod.map[i].size);
+            }
+        }
+        rc = 0;
+    }
+    else
+    {
+        fprintf(stderr, "File %s is not an LX module\n", name);
+    }
+    free(image);
+    fclose(f);
+    return rc;
+}
+
+// run decoder over the corpus for at least given time
+static void bench(const corpus_t *c, const decoder_t *d, double seconds)
+{
+    static uint8_t out[LX_PAGE_SIZE], check[LX_PAGE_SIZE];
+    unpack_fn fn = (c->mode == 2) ? d->unpack2 : d->unpack1;
+    unpack_fn ref = (c->mode == 2) ? decoders[0].unpack2 : decoders[0].unpack1;
+    uint64_t bytes = 0, in = 0, pages = 0, t0c;
+    double t0, t;
+    uint32_t i;
+    int16_t len;
+
+    if (!fn)
+    {
+        return;
+    }
+    // results must be the same as of the baseline
+    for (i = 0; i < c->count; i++)
+    {
+        len = fn(out, c->page[i], c->size[i]);
+        if ((len != ref(check, c->page[i], c->size[i])) || ((len > 0) && !d->size_only && memcmp(out, check, len)))
+        {
+            printf("%-12s %-10s MISMATCH at page %u\n", c->name, d->name, i);
+            return;
+        }
+    }
+    t0 = now();
+    t0c = cycles();
+    do
+    {
+        for (i = 0; i < c->count; i++)
+        {
+            len = fn(out, c->page[i], c->size[i]);
+            bytes += (len > 0) ? len : 0;
+            in += c->size[i];
+        }
+        pages += c->count;
+        t = now() - t0;
+    }
+    while (t < seconds);
+    t0c = cycles() - t0c;
+    printf("%-12s %-10s %8llu %9.3f %10.1f %10.0f ", c->name, d->name, (unsigned long long)pages,
+           (double)in / bytes, bytes / t / 1e6, pages / t);
+    if (t0c)
+    {
+        printf("%7.2f\n", (double)t0c / bytes);
+    }
+    else
+    {
+        printf("%7s\n", "n/a");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    corpus_t corpus[8];
+    uint32_t count = 0, i, d;
+    uint64_t total;
+    double seconds = 0.5;
+    int arg = 1;
+
+    if ((argc > 2) && !strcmp(argv[1], "-t"))
+    {
+        seconds = atof(argv[2]);
+        arg = 3;
+    }
+    if ((argc > 1) && !strcmp(argv[1], "-h"))
+    {
+        fprintf(stdout, "USAGE: %s [-t <seconds per run>] [<LX file> ...]\n", argv[0]);
+        return 1;
+    }
+    if ( corpus_synth(&corpus[count++], "random:2", 2, GEN_RANDOM) ||
+         corpus_synth(&corpus[count++], "zero:2",   2, GEN_ZERO)   ||
+         corpus_synth(&corpus[count++], "code:2",   2, GEN_CODE)   ||
+         corpus_backref(&corpus[count++])                          ||
+         corpus_synth(&corpus[count++], "zero:1",   1, GEN_ZERO)   ||
+         corpus_synth(&corpus[count++], "code:1",   1, GEN_CODE)
+       )
+    {
+        fprintf(stderr, "Not enough memory\n");
+        return 2;
+    }
+    if (arg < argc)
+    {
+        memset(&corpus[count], 0, 2 * sizeof(corpus_t));
+        corpus[count].name = "lx:1";
+        corpus[count].mode = 1;
+        corpus[count + 1].name = "lx:2";
+        corpus[count + 1].mode = 2;
+        for (; arg < argc; arg++)
+        {
+            corpus_file(&corpus[count], &corpus[count + 1], argv[arg]);
+        }
+        count += 2;
+    }
+    fprintf(stdout, "%-12s %-10s %8s %9s %10s %10s %7s\n", "corpus", "decoder", "pages", "ratio", "MB/s", "pages/s", "cyc/B");
+    for (i = 0; i < count; i++)
+    {
+        if (!corpus[i].count)
+        {
+            continue;
+        }
+        for (d = 0; d < DECODERS; d++)
+        {
+            bench(&corpus[i], &decoders[d], seconds);
+        }
+        total = corpus[i].tokens[0] + corpus[i].tokens[1] + corpus[i].tokens[2] +
+                corpus[i].tokens[3] + corpus[i].tokens[4];
+        if (total)
+        {
+            fprintf(stdout, "%-12s tokens: literal %.0f%%, fill %.0f%%, short %.0f%%, mid %.0f%%, long %.0f%%\n",
+                    "", 100.0 * corpus[i].tokens[0] / total, 100.0 * corpus[i].tokens[1] / total,
+                    100.0 * corpus[i].tokens[2] / total, 100.0 * corpus[i].tokens[3] / total,
+                    100.0 * corpus[i].tokens[4] / total);
+        }
+    }
+    return 0;
+}
@@ -1,81 +1,451 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
 
 #define LX_UNPACK_IMPLEMENTATION
 #include "lxunpack.h"
+#define LX_MODULE_IMPLEMENTATION
+#include "lxmodule.h"
+#define LX_FIXUP_IMPLEMENTATION
+#include "lxfixup.h"
+#define LX_PIPE_IMPLEMENTATION
+#include "lxpipe.h"
+
+// one packed page of the input
+typedef struct page_s
+{
+    uint8_t    *src;
+    int16_t     size;
+    uint32_t    pos;             // place of the unpacked page in output
+    int16_t     len;             // its unpacked size, -1 if page is bad
+} page_t;
 
-FILE *fi = NULL;
 FILE *fo = NULL;
 
-uint8_t pak[LX_PAGE_SIZE] = {0};
-uint8_t unp[LX_PAGE_SIZE] = {0};
+uint8_t *pak = NULL;             // whole input file
+uint32_t flen = 0;
+int mapped = 0;
+uint8_t *unp = NULL;             // whole output
+page_t *page = NULL;
+lx_fixpage_t *fixups = NULL;     // fixups of all pages of the module
+uint32_t *bases = NULL;          // objects at their preferred addresses
+uint8_t **dsts = NULL;           // place of each unpacked page for the pipelined loader
+
+// map whole input file, or read it where there is no mmap
+static uint8_t *load_file(const char *name, uint32_t *size, int *is_mapped)
+{
+    uint8_t *data = NULL;
+    FILE *f;
+    long len;
+
+#ifdef HAVE_MMAP
+    struct stat st;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (!fstat(fd, &st) && (st.st_size > 0) && (st.st_size <= 0xFFFFFFFFL))
+    {
+        data = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != (uint8_t *)MAP_FAILED)
+        {
+            close(fd);
+            *size = (uint32_t)st.st_size;
+            *is_mapped = 1;
+            return data;
+        }
+        data = NULL;
+    }
+    close(fd);
+#endif
+    f = fopen(name, "rb");
+    if (!f)
+    {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len >= 0)
+    {
+        data = (uint8_t *)malloc(len ? len : 1);
+    }
+    if (data && (len != (long)fread(data, 1, len, f)))
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = (uint32_t)len;
+    *is_mapped = 0;
+    return data;
+}
+
+// read callback of the pipelined loader
+static int pipe_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t size)
+{
+    FILE *f = (FILE *)ctx;
+
+    if (fseek(f, offset, SEEK_SET) || (size != fread(buf, 1, size, f)))
+    {
+        return LX_MOD_ERR_DATA;
+    }
+    return LX_MOD_OK;
+}
+
+// write callback of the pipelined loader, page goes to its object
+static int pipe_write(void *ctx, uint32_t page, const uint8_t *data)
+{
+    uint8_t **dst = (uint8_t **)ctx;
+
+    if (dst[page])
+    {
+        memcpy(dst[page], data, LX_PAGE_SIZE);
+    }
+    return LX_MOD_OK;
+}
+
+static void free_file(uint8_t *data, uint32_t size, int is_mapped)
+{
+#ifdef HAVE_MMAP
+    if (is_mapped)
+    {
+        munmap(data, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)is_mapped;
+    free(data);
+}
+
+// split input into pages: one raw page, or pages each preceded by 16-bit size
+static int32_t split_pages(int many)
+{
+    uint32_t count = 0, i, size;
+
+    if (!many)
+    {
+        page = (page_t *)calloc(1, sizeof(page_t));
+        if (!page)
+        {
+            return -1;
+        }
+        page[0].src = pak;
+        page[0].size = (flen > LX_PAGE_SIZE) ? LX_PAGE_SIZE : (int16_t)flen;
+        return 1;
+    }
+    for (i = 0; i + 2 <= flen; i += 2 + size, count++)
+    {
+        size = pak[i] | ((uint32_t)pak[i + 1] << 8);
+    }
+    if ((i != flen) || !count)
+    {
+        return -1;
+    }
+    page = (page_t *)calloc(count, sizeof(page_t));
+    if (!page)
+    {
+        return -1;
+    }
+    for (i = 0, count = 0; i < flen; i += 2 + size, count++)
+    {
+        size = pak[i] | ((uint32_t)pak[i + 1] << 8);
+        if (size > 0x7FFF)
+        {
+            return -1;
+        }
+        page[count].src = &pak[i + 2];
+        page[count].size = (int16_t)size;
+    }
+    return count;
+}
 
 int main(int argc, char *argv[])
 {
-    int32_t flen, ulen, mode;
+    lx_module_t mod;
+    uint8_t **objects = NULL;
+    int32_t count = 0, bad = 0, i;
+    uint32_t total = 0, pages = 0, repeat = 1, r;
+    lx_fixenv_t env;
+    lx_pipe_t lxp;
+    FILE *fi = NULL;
+    uint32_t p;
+    int arg = 1, many = 0, check = 0, fix = 0, piped = 0, mode;
+    double t;
+    clock_t t0;
     int rc = 0;
 
-    if (argc < 4) 
+    memset(&lxp, 0, sizeof(lxp));
+    for (; (arg < argc) && (argv[arg][0] == '-'); arg++)
     {
-        fprintf(stdout, "USAGE: %s <mode: 1 or 2> <input file> <output file>\n", argv[0]);
-        rc = 1;
-        goto end;
+        if (!strcmp(argv[arg], "-n"))
+        {
+            many = 1;
+        }
+        else if (!strcmp(argv[arg], "-c"))
+        {
+            check = 1;
+        }
+        else if (!strcmp(argv[arg], "-f"))
+        {
+            fix = 1;
+        }
+        else if (!strcmp(argv[arg], "-p"))
+        {
+            piped = 1;
+        }
+        else if (!strcmp(argv[arg], "-r") && (arg + 1 < argc))
+        {
+            repeat = atoi(argv[++arg]);
+        }
+        else
+        {
+            break;
+        }
     }
-    mode = atoi(argv[1]);
-    if ((mode != 1) && (mode != 2))
+    if (argc - arg < 3)
     {
-        fprintf(stderr, "Wrong unpacking mode %s, must be 1 or 2!\n", argv[1]);
+        fprintf(stdout, "USAGE: %s [-n] [-c] [-f] [-p] [-r <repeat>] <mode: 1, 2 or lx> <input file> <output file>\n"
+                        "  1, 2 - input is one page packed with EXEPACK:1 or EXEPACK:2,\n"
+                        "         -n - many pages, each preceded by its 16-bit size\n"
+                        "  lx   - input is an LX module, output is all its objects unpacked\n"
+                        "  -c   - check EXEPACK:2 pages once and unpack them without bounds checks\n"
+                        "  -f   - apply fixups, objects at their preferred addresses, imports as 0\n"
+                        "  -p   - read and unpack pages of the module by the pipelined loader, no -f\n"
+                        "  -r   - unpack repeat times for timing\n", argv[0]);
         rc = 1;
         goto end;
     }
-    fi = fopen(argv[2], "rb");
-    if (!fi)
+    mode = !strcmp(argv[arg], "lx") ? 3 : atoi(argv[arg]);
+    if ((mode != 1) && (mode != 2) && (mode != 3))
     {
-        fprintf(stderr, "Error to open file %s\n", argv[2]);
-        rc = 2;
+        fprintf(stderr, "Wrong unpacking mode %s, must be 1, 2 or lx!\n", argv[arg]);
+        rc = 1;
         goto end;
     }
-    fo = fopen(argv[3], "wb");
-    if (!fo)
+    if (fix && piped)
     {
-        fprintf(stderr, "Error to create file %s\n", argv[3]);
-        rc = 3;
+        fprintf(stderr, "Fixups are not applied by the pipelined loader, -f and -p can not be used together!\n");
+        rc = 1;
         goto end;
     }
-    fseek(fi, 0, SEEK_END);
-    flen = ftell(fi);
-    fseek(fi, 0, SEEK_SET);
-    if (flen > LX_PAGE_SIZE)
+    if (!repeat)
     {
-        flen = LX_PAGE_SIZE;
+        repeat = 1;
     }
-    if (flen != fread(pak, 1, flen, fi))
+    pak = load_file(argv[arg + 1], &flen, &mapped);
+    if (!pak)
     {
-        fprintf(stderr, "Error to read file %s\n", argv[2]);
-        rc = 4;
+        fprintf(stderr, "Error to read file %s\n", argv[arg + 1]);
+        rc = 2;
         goto end;
     }
-    if (mode == 2)
+    fo = fopen(argv[arg + 2], "wb");
+    if (!fo)
     {
-        ulen = lx_unpack2(unp, pak, flen);
+        fprintf(stderr, "Error to create file %s\n", argv[arg + 2]);
+        rc = 3;
+        goto end;
     }
-    else
+    if ((mode == 3) && piped)
     {
-        ulen = lx_unpack1(unp, pak, flen);
+        // module comes from the file, not from its image in memory
+        fi = fopen(argv[arg + 1], "rb");
+        if (!fi || (lx_pipe_open(&lxp, pipe_read, fi) != LX_MOD_OK))
+        {
+            fprintf(stderr, "File %s is not an LX module\n", argv[arg + 1]);
+            rc = 4;
+            goto end;
+        }
+        mod = lxp.mod;
     }
-    if (ulen > 0)
+    if (mode == 3)
     {
-        fprintf(stdout, "Unpacking %d from %d bytes succeed\n", ulen, flen);
+        if (!piped && (lx_module_open(&mod, pak, flen) != LX_MOD_OK))
+        {
+            fprintf(stderr, "File %s is not an LX module\n", argv[arg + 1]);
+            rc = 4;
+            goto end;
+        }
+        if (check && !piped && (lx_module_check(&mod) != LX_MOD_OK))
+        {
+            fprintf(stderr, "Module %s has bad pages\n", argv[arg + 1]);
+            rc = 4;
+            goto end;
+        }
+        // all objects go one after another into single buffer
+        objects = (uint8_t **)malloc((mod.hdr->objcnt + 1) * sizeof(uint8_t *));
+        for (i = 0; i < (int32_t)mod.hdr->objcnt; i++)
+        {
+            total += lx_object_size(&mod, i);
+            pages += mod.obj[i].mapsize;
+        }
+        unp = (uint8_t *)malloc(total ? total : 1);
+        if (!objects || !unp)
+        {
+            fprintf(stderr, "Not enough memory\n");
+            rc = 4;
+            goto end;
+        }
+        for (i = 0, total = 0; i < (int32_t)mod.hdr->objcnt; i++)
+        {
+            objects[i] = unp + total;
+            total += lx_object_size(&mod, i);
+        }
+        if (piped)
+        {
+            dsts = (uint8_t **)calloc(mod.hdr->mpages + 1, sizeof(uint8_t *));
+            if (!dsts)
+            {
+                fprintf(stderr, "Not enough memory\n");
+                rc = 4;
+                goto end;
+            }
+            for (i = 0; i < (int32_t)mod.hdr->objcnt; i++)
+            {
+                for (p = 0; p < mod.obj[i].mapsize; p++)
+                {
+                    dsts[mod.obj[i].pagemap - 1 + p] = objects[i] + p * LX_PAGE_SIZE;
+                }
+                // pages not present in file
+                memset(objects[i] + p * LX_PAGE_SIZE, 0, lx_object_size(&mod, i) - p * LX_PAGE_SIZE);
+            }
+        }
+        if (fix)
+        {
+            // fixups are decoded once, then applied as each page is unpacked
+            fixups = (lx_fixpage_t *)calloc(mod.hdr->mpages + 1, sizeof(lx_fixpage_t));
+            bases = (uint32_t *)malloc((mod.hdr->objcnt + 1) * sizeof(uint32_t));
+            if (!fixups || !bases || (lx_fixup_module(&mod, fixups) != LX_MOD_OK))
+            {
+                fprintf(stderr, "Fixups of module %s are broken\n", argv[arg + 1]);
+                free(fixups);
+                fixups = NULL;
+                rc = 4;
+                goto end;
+            }
+            for (i = 0; i < (int32_t)mod.hdr->objcnt; i++)
+            {
+                bases[i] = mod.obj[i].base;
+            }
+            memset(&env, 0, sizeof(env));
+            env.base = bases;
+        }
+        t0 = clock();
+        for (r = 0; r < repeat; r++)
+        {
+            for (i = 0; fix && (i < (int32_t)mod.hdr->objcnt); i++)
+            {
+                if ((rc = lx_fixup_object(&mod, i, fixups, objects[i], lx_object_size(&mod, i), &env)) != LX_MOD_OK)
+                {
+                    break;
+                }
+            }
+            if (piped)
+            {
+                rc = lx_pipe_run(&lxp, pipe_write, dsts);
+            }
+            else if (!fix)
+            {
+                rc = lx_unpack_module(&mod, objects);
+            }
+            if (rc != LX_MOD_OK)
+            {
+                fprintf(stderr, "Unpacking of module failed with %d\n", rc);
+                rc = 4;
+                goto end;
+            }
+        }
+        t = (double)(clock() - t0) / CLOCKS_PER_SEC;
+        count = mod.hdr->objcnt;
+        fprintf(stdout, "Unpacked %u objects, %u pages into %u bytes\n", count, pages, total);
+        if (piped)
+        {
+            fprintf(stdout, "Pipeline: decoder waited for input %u times, reader for buffers %u times\n",
+                    (uint32_t)lxp.decode_waits, (uint32_t)lxp.read_waits);
+        }
     }
     else
     {
-        fprintf(stdout, "Unpacking %d bytes failed after %d bytes\n", flen, -ulen);
+        count = split_pages(many);
+        if (count < 0)
+        {
+            fprintf(stderr, "Wrong page sizes in file %s\n", argv[arg + 1]);
+            rc = 4;
+            goto end;
+        }
+        // place pages by their unpacked sizes, decoder may use a page of room
+        for (i = 0; i < count; i++)
+        {
+            page[i].pos = total;
+            page[i].len = (mode == 2) ? lx_unpack2_size(page[i].src, page[i].size) :
+                                        lx_unpack1_size(page[i].src, page[i].size);
+            if (page[i].len < 0)
+            {
+                fprintf(stdout, "Unpacking of page %d (%d bytes) failed\n", i, page[i].size);
+                bad++;
+                continue;
+            }
+            total += page[i].len;
+        }
+        unp = (uint8_t *)malloc(total + LX_PAGE_SIZE);
+        if (!unp)
+        {
+            fprintf(stderr, "Not enough memory\n");
+            rc = 4;
+            goto end;
+        }
+        t0 = clock();
+        for (r = 0; r < repeat; r++)
+        {
+            for (i = 0; i < count; i++)
+            {
+                if (page[i].len < 0)
+                {
+                    continue;
+                }
+                if ((mode == 2) && check)
+                {
+                    // page is checked by lx_unpack2_size above
+                    lx_unpack2_unchecked(unp + page[i].pos, page[i].src, page[i].size);
+                }
+                else if (mode == 2)
+                {
+                    lx_unpack2(unp + page[i].pos, page[i].src, page[i].size);
+                }
+                else
+                {
+                    lx_unpack1(unp + page[i].pos, page[i].src, page[i].size);
+                }
+            }
+        }
+        t = (double)(clock() - t0) / CLOCKS_PER_SEC;
+        pages = count - bad;
+        fprintf(stdout, "Unpacking %u from %u bytes in %u pages succeed, %d pages failed\n", total, flen, pages, bad);
+    }
+    if (t > 0)
+    {
+        fprintf(stdout, "%u times in %.3f s: %.0f pages/s, %.1f MB/s\n", repeat, t,
+                (double)pages * repeat / t, (double)total * repeat / t / 1e6);
     }
     fflush(stdout);
-    if (ulen != fwrite(unp, 1, ulen, fo))
+    // whole output at once
+    if (total != fwrite(unp, 1, total, fo))
     {
-        fprintf(stderr, "Error to write file %s\n", argv[3]);
+        fprintf(stderr, "Error to write file %s\n", argv[arg + 2]);
         rc = 5;
         goto end;
     }
@@ -83,7 +453,20 @@ int main(int argc, char *argv[])
     fflush(stdout);
 
 end:
-    if (fi) fclose(fi);
     if (fo) fclose(fo);
+    if (fixups)
+    {
+        // before the module image is gone
+        lx_fixup_free_module(&mod, fixups);
+        free(fixups);
+    }
+    if (pak) free_file(pak, flen, mapped);
+    if (fi) fclose(fi);
+    lx_pipe_close(&lxp);
+    free(dsts);
+    free(bases);
+    free(objects);
+    free(unp);
+    free(page);
     return rc;
 }